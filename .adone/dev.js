@@ -253,7 +253,8 @@ export default {
                                 native: {
                                     task: "cmake",
                                     src: "src/glosses/compressors/snappy/native",
-                                    dst: "lib/glosses/compressors/snappy/native"
+                                    dst: "lib/glosses/compressors/snappy/native",
+                                    prebuilds: true
                                 }
                             }
                         },
@@ -276,7 +277,16 @@ export default {
                     src: "src/glosses/crypto/**/*.js",
                     dst: "lib/glosses/crypto",
                     task: "transpile",
-                    predecessor: "https://github.com/digitalbazaar/forge"
+                    predecessor: "https://github.com/digitalbazaar/forge",
+                    units: {
+                        crc: {
+                            description: "CRC-32 and CRC-32C kernels",
+                            task: "cmake",
+                            src: "src/glosses/crypto/crc/native",
+                            dst: "lib/glosses/crypto/crc/native",
+                            prebuilds: true
+                        }
+                    }
                 },
                 data: {
                     description: "Data generic manipulation utilites and serializers",
@@ -423,13 +433,13 @@ export default {
                             task: "transpile",
                             units: {
                                 fsevents: {
-                                    platform: "darwin",
+                                    platform: ["darwin", "linux"],
                                     task: "transpile",
                                     src: "src/glosses/fs/extra/watcher/fsevents.js",
                                     dst: "lib/glosses/fs/extra/watcher"
                                 },
                                 native: {
-                                    platform: "darwin",
+                                    platform: ["darwin", "linux"],
                                     task: "cmake",
                                     src: "src/glosses/fs/extra/watcher/native",
                                     dst: "lib/glosses/fs/extra/watcher/native"
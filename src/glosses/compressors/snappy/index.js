@@ -1,71 +1,221 @@
+import FramingStream from "./stream";
+
 const { is } = adone;
 const native = adone.requireAddon(adone.path.join(__dirname, "native", "snappy.node"));
 
 adone.asNamespace(exports);
 
+/**
+ * Compression levels. Every level produces standard snappy data that any snappy decoder reads.
+ *
+ * FAST looks at fewer positions and gives up on incompressible data sooner, DEFAULT is the
+ * snappy compressor itself and BEST searches harder for longer matches, for a better ratio.
+ */
+export const levels = Object.freeze({
+    FAST: 1,
+    DEFAULT: 2,
+    BEST: 3
+});
+
+/**
+ * Async work runs on a thread pool of the addon instead of the libuv one, so bulk compression
+ * does not hold up fs and dns requests. When the queue of the pool is full the native methods
+ * return null instead of a promise; such calls wait here, in order, until the pool drains.
+ * At most maxWaiting calls wait, the ones beyond are rejected with a LimitExceededException.
+ */
+const waiting = [];
+let maxWaiting = 1024;
+
+const resume = () => {
+    while (waiting.length > 0) {
+        const { method, args, resolve, reject } = waiting[0];
+        let promise;
+        try {
+            promise = method(...args);
+        } catch (err) {
+            waiting.shift();
+            reject(err);
+            continue;
+        }
+        if (is.null(promise)) {
+            return;
+        }
+        waiting.shift();
+        resolve(promise);
+    }
+};
+
+native.executor.onDrain(resume);
+
+const submit = (method, ...args) => {
+    if (waiting.length === 0) {
+        const promise = method(...args);
+        if (!is.null(promise)) {
+            return promise;
+        }
+    }
+    if (waiting.length >= maxWaiting) {
+        return Promise.reject(new adone.error.LimitExceededException("Snappy executor is saturated"));
+    }
+    return new Promise((resolve, reject) => waiting.push({ method, args, resolve, reject }));
+};
+
+const checkCount = (value, name, min = 1) => {
+    if (!is.undefined(value) && !(is.integer(value) && value >= min)) {
+        throw new Error(min === 1 ? `${name} must be a positive integer` : `${name} must be a non-negative integer`);
+    }
+    return value;
+};
+
+/**
+ * Thread pool of the async methods.
+ *
+ * Inputs up to 64 KiB are taken before larger ones, and batches and framed streams after both.
+ * Each of these three lanes queues at most queueDepth jobs, up to maxWaiting calls beyond that
+ * wait in JS and the rest are rejected with a LimitExceededException, so callers see when the
+ * pool is saturated and can shed or delay work.
+ */
+export const executor = {
+    /**
+     * @param {Object} [options]
+     * @param {number} [options.threads] number of threads, by default the number of cores up to 4
+     * @param {number} [options.queueDepth] jobs queued per lane, 1024 by default
+     * @param {number} [options.maxWaiting] calls waiting in JS for a full lane, 1024 by default;
+     * with 0 a call is rejected as soon as its lane is full
+     */
+    configure({ threads, queueDepth, maxWaiting: limit } = {}) {
+        const options = {
+            threads: checkCount(threads, "threads"),
+            queueDepth: checkCount(queueDepth, "queueDepth")
+        };
+        checkCount(limit, "maxWaiting", 0);
+
+        native.executor.configure(options);
+        if (!is.undefined(limit)) {
+            maxWaiting = limit;
+        }
+    },
+
+    /**
+     * Returns { threads, queueDepth, queued: { high, normal, low }, running, completed, rejected, waiting, maxWaiting },
+     * where rejected counts the calls the pool refused and waiting the calls waiting in JS.
+     */
+    stats() {
+        return {
+            ...native.executor.stats(),
+            waiting: waiting.length,
+            maxWaiting
+        };
+    }
+};
+
+const checkLevel = (value) => {
+    if (is.undefined(value)) {
+        return levels.DEFAULT;
+    }
+    if (value !== levels.FAST && value !== levels.DEFAULT && value !== levels.BEST) {
+        throw new Error("Level must be 1 (fast), 2 (default) or 3 (best)");
+    }
+    return value;
+};
+
 /**
  * Compress asyncronous.
  * If input isn't a string or buffer, automatically convert to buffer by using
  * JSON.stringify.
+ *
+ * With adaptive, parts of the input that do not compress (images, encrypted or already compressed
+ * data) are stored as they are. Large parts are judged from a few samples compressed on trial,
+ * so they cost a fraction of a compression. The output is still standard snappy data.
+ *
+ * @param {Object} [options]
+ * @param {number} [options.level] compression level, see levels
+ * @param {boolean} [options.adaptive] store what does not compress instead of compressing it
  */
-export const compress = function (input) {
+export const compress = function (input, { level, adaptive = false } = {}) {
     if (!is.string(input) && !is.buffer(input)) {
         throw new Error("Input must be a String or a Buffer");
     }
 
-    return new Promise((resolve, reject) => {
-        native.compress(input, (err, result) => {
-            if (err) {
-                return reject(err);
-            }
-            resolve(result);
-        });
-    });
+    return submit(native.compress, input, checkLevel(level), Boolean(adaptive));
 };
 
-export const compressSync = function (input) {
+export const compressSync = function (input, { level, adaptive = false } = {}) {
     if (!is.string(input) && !is.buffer(input)) {
         throw new Error("input must be a String or a Buffer");
     }
 
-    return native.compressSync(input);
+    return native.compressSync(input, checkLevel(level), Boolean(adaptive));
 };
 
 /**
  * Asyncronous decide if a buffer is compressed in a correct way.
  */
-export const isValidCompressed = (input) => {
-    return new Promise((resolve, reject) => {
-        native.isValidCompressed(input, (err, result) => {
-            if (err) {
-                return reject(err);
-            }
-            resolve(result);
-        });
-    });
-};
+export const isValidCompressed = (compressed) => submit(native.isValidCompressed, compressed);
 
 export const isValidCompressedSync = native.isValidCompressedSync;
 
-const uncompressOpts = (opts) => (opts && is.boolean(opts.asBuffer)) ? opts : { asBuffer: true };
+/**
+ * Decompression kernels chosen for this CPU at load time: "avx2" or "generic".
+ */
+export const kernels = native.kernels;
+
+/**
+ * Counters of the work done by snappy in this process, always on and cheap enough for production.
+ *
+ * Returns an object per operation (compress, uncompress, isValidCompressed, compressFramed,
+ * uncompressFramed, compressBatch, uncompressBatch, compressStream and uncompressStream), each with
+ * calls, asyncCalls, failures, bytesIn, bytesOut, executeNs (time spent compressing or
+ * decompressing), queueWaitNs (time async calls waited for a thread of the pool) and storedBytes
+ * (input that the adaptive mode stored instead of compressing). Sync and
+ * async calls add up in the same counters. bytesOut / bytesIn of compress is its ratio.
+ *
+ * @param {Object} [options]
+ * @param {boolean} [options.reset] start counting from zero again after reading
+ */
+export const stats = function ({ reset = false } = {}) {
+    return native.stats(reset);
+};
+
+/**
+ * Reads the uncompressed length from the header of compressed data, in place and without
+ * validating the rest, e.g. to size buffers or enforce limits before decompressing.
+ */
+export const getUncompressedLength = function (compressed) {
+    if (!is.buffer(compressed)) {
+        throw new Error("Input must be a Buffer");
+    }
+
+    return native.getUncompressedLength(compressed);
+};
+
+const checkMaxOutput = (maxOutput) => {
+    if (!is.undefined(maxOutput) && !(is.number(maxOutput) && maxOutput >= 0)) {
+        throw new Error("maxOutput must be a non-negative number");
+    }
+    return maxOutput;
+};
+
+const uncompressOpts = (opts) => ({
+    asBuffer: (opts && is.boolean(opts.asBuffer)) ? opts.asBuffer : true,
+    maxOutput: checkMaxOutput(opts ? opts.maxOutput : undefined)
+});
 
 /**
  * Asyncronous uncompress previously compressed data.
  * A parser can be attached. If no parser is attached, return buffer.
+ *
+ * @param {Object} [opts]
+ * @param {boolean} [opts.asBuffer] return a Buffer (default) or a string
+ * @param {number} [opts.maxOutput] largest uncompressed length accepted; longer data is rejected
+ * with a RangeError before anything is allocated
  */
 export const decompress = function (compressed, opts) {
     if (!is.buffer(compressed)) {
         throw new Error("Input must be a Buffer");
     }
 
-    return new Promise((resolve, reject) => {
-        native.uncompress(compressed, uncompressOpts(opts), (err, result) => {
-            if (err) {
-                return reject(err);
-            }
-            resolve(result);
-        });
-    });
+    return submit(native.uncompress, compressed, uncompressOpts(opts));
 };
 
 export const decompressSync = function (compressed, opts) {
@@ -75,3 +225,256 @@ export const decompressSync = function (compressed, opts) {
 
     return native.uncompressSync(compressed, uncompressOpts(opts));
 };
+
+const outputBuffer = (output) => {
+    if (is.arrayBuffer(output)) {
+        return Buffer.from(output);
+    }
+    if (!is.buffer(output)) {
+        throw new Error("Output must be a Buffer or an ArrayBuffer");
+    }
+    return output;
+};
+
+/**
+ * Asyncronous compress into an existing Buffer or ArrayBuffer starting at offset.
+ * Resolves with the number of bytes written, rejects with RangeError if the output is too small.
+ */
+export const compressInto = function (input, output, offset = 0, { level } = {}) {
+    if (!is.string(input) && !is.buffer(input)) {
+        throw new Error("Input must be a String or a Buffer");
+    }
+    output = outputBuffer(output);
+
+    return submit(native.compressInto, input, output, offset, checkLevel(level));
+};
+
+export const compressIntoSync = function (input, output, offset = 0, { level } = {}) {
+    if (!is.string(input) && !is.buffer(input)) {
+        throw new Error("Input must be a String or a Buffer");
+    }
+
+    return native.compressIntoSync(input, outputBuffer(output), offset, checkLevel(level));
+};
+
+/**
+ * Asyncronous uncompress into an existing Buffer or ArrayBuffer starting at offset.
+ * Resolves with the number of bytes written, rejects with RangeError if the output is too small.
+ */
+export const decompressInto = function (compressed, output, offset = 0) {
+    if (!is.buffer(compressed)) {
+        throw new Error("Input must be a Buffer");
+    }
+    output = outputBuffer(output);
+
+    return submit(native.uncompressInto, compressed, output, offset);
+};
+
+export const decompressIntoSync = function (compressed, output, offset = 0) {
+    if (!is.buffer(compressed)) {
+        throw new Error("Input must be a Buffer");
+    }
+
+    return native.uncompressIntoSync(compressed, outputBuffer(output), offset);
+};
+
+// Buffers of an array or a BufferList, ArrayBuffers taken as Buffers.
+const outputBuffers = (outputs) => {
+    if (adone.collections.BufferList.BufferList.isBufferList(outputs)) {
+        return outputs._bufs.slice();
+    }
+    if (!is.array(outputs)) {
+        throw new Error("Outputs must be an Array or a BufferList");
+    }
+    return outputs.map(outputBuffer);
+};
+
+/**
+ * Asyncronous uncompress into several existing Buffers, e.g. the page sized Buffers of a BufferList,
+ * filling one after the other, so large outputs need no contiguous allocation.
+ * Resolves with the number of bytes written, rejects with RangeError if the outputs are too small.
+ */
+export const decompressToBuffers = function (compressed, outputs) {
+    if (!is.buffer(compressed)) {
+        throw new Error("Input must be a Buffer");
+    }
+    outputs = outputBuffers(outputs);
+
+    return submit(native.uncompressToBuffers, compressed, outputs);
+};
+
+export const decompressToBuffersSync = function (compressed, outputs) {
+    if (!is.buffer(compressed)) {
+        throw new Error("Input must be a Buffer");
+    }
+
+    return native.uncompressToBuffersSync(compressed, outputBuffers(outputs));
+};
+
+/**
+ * Asyncronous compress into the snappy framing format using several threads.
+ * Blocks of 64 KB are compressed concurrently by the idle threads of the pool, so throughput
+ * scales with its threads on large inputs.
+ * The result can be consumed by decompressFramed() or decompressStream().
+ *
+ * @param {Object} [options]
+ * @param {number} [options.threads] most threads to use, defaults to every thread of the pool
+ * @param {number} [options.level] compression level, see levels
+ */
+export const compressFramed = function (input, { threads = 0, level } = {}) {
+    if (!is.string(input) && !is.buffer(input)) {
+        throw new Error("Input must be a String or a Buffer");
+    }
+
+    return submit(native.compressFramed, input, threads, checkLevel(level));
+};
+
+/**
+ * Asyncronous uncompress of a complete snappy framing format stream using several threads of the pool.
+ *
+ * @param {Object} [options]
+ * @param {number} [options.threads] most threads to use, defaults to every thread of the pool
+ */
+export const decompressFramed = function (framed, { threads = 0 } = {}) {
+    if (!is.buffer(framed)) {
+        throw new Error("Input must be a Buffer");
+    }
+
+    return submit(native.uncompressFramed, framed, threads);
+};
+
+// Native batches come as [data, offsets], offsets holding a Float64Array of count + 1 entries.
+const batchResult = ([data, offsets], packed) => {
+    offsets = new Float64Array(offsets.buffer, offsets.byteOffset, offsets.length / Float64Array.BYTES_PER_ELEMENT);
+    if (packed) {
+        return { data, offsets };
+    }
+    const res = new Array(offsets.length - 1);
+    for (let i = 0; i < res.length; ++i) {
+        res[i] = data.subarray(offsets[i], offsets[i + 1]);
+    }
+    return res;
+};
+
+const checkBatch = (inputs, acceptStrings) => {
+    if (!is.array(inputs)) {
+        throw new Error("Inputs must be an Array");
+    }
+    for (const input of inputs) {
+        if (!is.buffer(input) && !(acceptStrings && is.string(input))) {
+            throw new Error(acceptStrings ? "Input must be a String or a Buffer" : "Input must be a Buffer");
+        }
+    }
+};
+
+/**
+ * Asyncronous compress of many inputs at once, in a single native call and worker.
+ * Resolves with an array of Buffer views of one contiguous Buffer, or, with packed option,
+ * with the contiguous Buffer itself and the offsets of the results ({ data, offsets }).
+ */
+export const compressBatch = function (inputs, { packed = false, level } = {}) {
+    checkBatch(inputs, true);
+    level = checkLevel(level);
+
+    return submit(native.compressBatch, inputs, level).then((result) => batchResult(result, packed));
+};
+
+export const compressBatchSync = function (inputs, { packed = false, level } = {}) {
+    checkBatch(inputs, true);
+
+    return batchResult(native.compressBatchSync(inputs, checkLevel(level)), packed);
+};
+
+/**
+ * Asyncronous uncompress of many inputs at once, see compressBatch().
+ */
+export const decompressBatch = function (inputs, { packed = false } = {}) {
+    checkBatch(inputs, false);
+
+    return submit(native.uncompressBatch, inputs).then((result) => batchResult(result, packed));
+};
+
+export const decompressBatchSync = function (inputs, { packed = false } = {}) {
+    checkBatch(inputs, false);
+
+    return batchResult(native.uncompressBatchSync(inputs), packed);
+};
+
+/**
+ * Compression context for synchronous calls. The memory snappy needs for compressing is
+ * allocated once per context and reused by every call, instead of on every call.
+ * Asynchronous functions use a context of their worker thread in the same way.
+ */
+export class Context {
+    constructor() {
+        this.native = new native.Context();
+    }
+
+    compressSync(input, { level, adaptive = false } = {}) {
+        if (!is.string(input) && !is.buffer(input)) {
+            throw new Error("Input must be a String or a Buffer");
+        }
+
+        return this.native.compressSync(input, checkLevel(level), Boolean(adaptive));
+    }
+
+    compressIntoSync(input, output, offset = 0, { level } = {}) {
+        if (!is.string(input) && !is.buffer(input)) {
+            throw new Error("Input must be a String or a Buffer");
+        }
+
+        return this.native.compressIntoSync(input, outputBuffer(output), offset, checkLevel(level));
+    }
+}
+
+/**
+ * Incremental decoder of a single compressed block, such as the output of compress(), for input
+ * that arrives in pieces. Decoding proceeds with every chunk instead of starting once the whole
+ * block has been received, and the decoder state is kept between chunks.
+ *
+ * The output is allocated at once when the length header has been read; push() returns views of it.
+ */
+export class Decoder {
+    /**
+     * @param {Object} [options]
+     * @param {number} [options.maxOutput] largest uncompressed length accepted, see decompress()
+     */
+    constructor({ maxOutput } = {}) {
+        this.native = new native.Decoder(checkMaxOutput(maxOutput));
+        this.produced = 0;
+    }
+
+    /**
+     * Decodes a chunk, returns the output that became available with it (may be empty).
+     */
+    push(chunk) {
+        if (!is.buffer(chunk)) {
+            throw new Error("Input must be a Buffer");
+        }
+
+        const produced = this.native.push(chunk);
+        const start = this.produced;
+        this.produced = produced;
+        return produced > start ? this.native.output().subarray(start, produced) : Buffer.alloc(0);
+    }
+
+    /**
+     * Throws if the block is not complete, otherwise returns the whole output.
+     */
+    end() {
+        this.native.end();
+        return this.native.output();
+    }
+}
+
+/**
+ * Transform stream producing the snappy framing format (stream identifier, chunks of
+ * at most 64 KB with masked CRC-32C checksums).
+ * The level option sets the compression level, the other options go to the stream.
+ */
+export const compressStream = ({ level, ...options } = {}) => new FramingStream(new native.FrameEncoder(checkLevel(level)), options);
+
+/**
+ * Transform stream consuming the snappy framing format.
+ */
+export const decompressStream = (options) => new FramingStream(new native.FrameDecoder(), options);
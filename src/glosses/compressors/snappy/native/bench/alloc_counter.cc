@@ -0,0 +1,72 @@
+// Heap allocation counter for the binding benchmark.
+//
+// Preloaded into node (LD_PRELOAD), this library takes the place of malloc,
+// calloc and realloc of glibc and counts every call before forwarding it.
+// Loaded once more as an addon, it hands the count over to JS, so the
+// benchmark can report the allocations of a call into the binding: the ones
+// of snappy, of the binding itself and of node creating Buffers and strings.
+//
+// Allocations of other threads (V8 compilers, GC) are counted as well, so
+// counts are only meaningful as an average over many calls.
+
+#define NAPI_VERSION 4
+#define NAPI_DISABLE_CPP_EXCEPTIONS
+
+#include <napi.h>
+
+#include <atomic>
+#include <stddef.h>
+
+namespace
+{
+
+std::atomic<size_t> allocations(0);
+
+} // namespace
+
+#if defined(__GLIBC__)
+
+extern "C"
+{
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t count, size_t size);
+  void *__libc_realloc(void *p, size_t size);
+
+  void *malloc(size_t size)
+  {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+  }
+
+  void *calloc(size_t count, size_t size)
+  {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+  }
+
+  void *realloc(void *p, size_t size)
+  {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, size);
+  }
+}
+
+#endif // __GLIBC__
+
+namespace
+{
+
+Napi::Value Count(const Napi::CallbackInfo &info)
+{
+  return Napi::Number::New(info.Env(), static_cast<double>(allocations.load(std::memory_order_relaxed)));
+}
+
+Napi::Object Init(Napi::Env env, Napi::Object exports)
+{
+  exports.Set("count", Napi::Function::New(env, Count));
+  return exports;
+}
+
+} // namespace
+
+NODE_API_MODULE(alloc_counter, Init)
@@ -0,0 +1,116 @@
+// Microbenchmark for the input path of the snappy binding.
+//
+// Compares the old behaviour of copying every input into a heap allocated
+// std::string before calling into snappy with reading the caller's memory
+// in place, and reports heap allocations and throughput per call.
+
+#include <snappy.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+  ++allocations;
+  void *p = malloc(size);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+namespace
+{
+
+const int kIterations = 10000;
+
+std::string MakeInput(size_t length)
+{
+  std::string input;
+  input.reserve(length);
+  while (input.length() < length)
+    input.append("beep boop, hello world. OMG OMG OMG ");
+  input.resize(length);
+  return input;
+}
+
+template <typename Fn>
+void Run(const char *name, size_t length, Fn fn)
+{
+  size_t before = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kIterations; ++i)
+    fn();
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%-24s %8zu B %10.2f allocs/call %10.1f MB/s\n",
+         name, length,
+         double(allocations - before) / kIterations,
+         double(length) * kIterations / elapsed / (1 << 20));
+}
+
+void Bench(size_t length)
+{
+  const std::string source = MakeInput(length);
+  std::string compressed;
+  snappy::Compress(source.data(), source.length(), &compressed);
+
+  const char *data = source.data();
+  const char *cdata = compressed.data();
+  size_t clength = compressed.length();
+
+  Run("validate (copy)", clength, [&] {
+    std::string *input = new std::string(cdata, clength);
+    snappy::IsValidCompressedBuffer(input->data(), input->length());
+    delete input;
+  });
+  Run("validate (pinned)", clength, [&] {
+    snappy::IsValidCompressedBuffer(cdata, clength);
+  });
+
+  Run("compress (copy)", length, [&] {
+    std::string *input = new std::string(data, length);
+    std::string dst;
+    snappy::Compress(input->data(), input->length(), &dst);
+    delete input;
+  });
+  Run("compress (pinned)", length, [&] {
+    std::string dst;
+    snappy::Compress(data, length, &dst);
+  });
+
+  Run("uncompress (copy)", clength, [&] {
+    std::string *input = new std::string(cdata, clength);
+    std::string dst;
+    snappy::Uncompress(input->data(), input->length(), &dst);
+    delete input;
+  });
+  Run("uncompress (pinned)", clength, [&] {
+    std::string dst;
+    snappy::Uncompress(cdata, clength, &dst);
+  });
+}
+
+} // namespace
+
+int main()
+{
+  const size_t sizes[] = {64, 1024, 16 * 1024, 256 * 1024};
+  for (size_t length : sizes)
+    Bench(length);
+  return 0;
+}
@@ -0,0 +1,366 @@
+#include "codec.h"
+#include "kernels.h"
+
+#include <snappy.h>
+#include <snappy-internal.h>
+
+#include <stdlib.h> // malloc, realloc, free
+#include <string.h> // memcpy
+
+#include <algorithm>
+
+namespace nodesnappy
+{
+
+const char *kNotEnoughSpace = "Output buffer is too small";
+const char *kOutputTooLarge = "Uncompressed length exceeds maxOutput";
+
+namespace
+{
+
+// Length prefix of the snappy format, see snappy::Varint.
+char *EncodeVarint32(char *dst, uint32_t value)
+{
+  unsigned char *p = reinterpret_cast<unsigned char *>(dst);
+  while (value >= 0x80)
+  {
+    *p++ = static_cast<unsigned char>(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = static_cast<unsigned char>(value);
+  return reinterpret_cast<char *>(p);
+}
+
+// The adaptive mode compresses a fragment when it saves at least 1/16.
+inline bool Pays(size_t compressed, size_t length)
+{
+  return compressed < length - length / 16;
+}
+
+// Samples that the adaptive mode compresses on trial, spread evenly over a
+// fragment. Shorter fragments are compressed right away.
+const size_t kSampleCount = 4;
+const size_t kSampleSize = 1024;
+const size_t kMinSampledLength = 16 * 1024;
+
+// Output block of CompressToScratch() that a context keeps between calls.
+const size_t kScratchKept = 1024 * 1024;
+
+// Writes the data as a single literal element.
+char *EmitLiteral(char *op, const char *data, size_t length)
+{
+  uint32_t n = static_cast<uint32_t>(length - 1);
+  if (n < 60)
+  {
+    *op++ = static_cast<char>(n << 2);
+  }
+  else
+  {
+    int bytes = n < (1u << 8) ? 1 : n < (1u << 16) ? 2 : n < (1u << 24) ? 3 : 4;
+    *op++ = static_cast<char>((59 + bytes) << 2);
+    for (int i = 0; i < bytes; i++, n >>= 8)
+      *op++ = static_cast<char>(n);
+  }
+
+  memcpy(op, data, length);
+  return op + length;
+}
+
+// Number of hash table entries snappy uses for a fragment.
+int TableSize(size_t length)
+{
+  int size = 256;
+  while (size < static_cast<int>(snappy::kMaxHashTableSize) && static_cast<size_t>(size) < length)
+    size <<= 1;
+  return size;
+}
+
+} // namespace
+
+bool IsAscii(const char *data, size_t length)
+{
+  const char *end = data + length;
+
+  // Eight bytes at a time, then the tail.
+  for (; end - data >= 8; data += 8)
+  {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    if (word & 0x8080808080808080ULL)
+      return false;
+  }
+
+  for (; data < end; data++)
+  {
+    if (*data & 0x80)
+      return false;
+  }
+
+  return true;
+}
+
+Context::Context()
+    : wmem(new snappy::internal::WorkingMemory(snappy::kBlockSize)), buckets(NULL), scratch(NULL), scratchSize(0) {}
+
+Context::~Context()
+{
+  delete wmem;
+  free(buckets);
+  free(scratch);
+}
+
+char *Context::CompressFragment(const char *data, size_t length, char *op, int level)
+{
+  int tableSize;
+
+  switch (level)
+  {
+  case kLevelFast:
+  {
+    snappy::uint16 *table = wmem->GetHashTable(std::min(length, kFastTableSize), &tableSize);
+    return CompressFragmentFast(data, length, op, table, tableSize);
+  }
+
+  case kLevelBest:
+  {
+    tableSize = TableSize(length);
+    if (buckets == NULL)
+    {
+      buckets = static_cast<uint16_t *>(malloc(2 * snappy::kMaxHashTableSize * sizeof(uint16_t)));
+      if (buckets == NULL)
+        break;
+    }
+    memset(buckets, 0, 2 * tableSize * sizeof(uint16_t));
+    return CompressFragmentBest(data, length, op, buckets, tableSize);
+  }
+  }
+
+  // The default level, also used when the memory of the best one is missing.
+  snappy::uint16 *table = wmem->GetHashTable(length, &tableSize);
+  return snappy::internal::CompressFragment(data, length, op, table, tableSize);
+}
+
+bool Context::SamplesCompress(const char *data, size_t length)
+{
+  char scratch[32 + kSampleSize + kSampleSize / 6]; // MaxCompressedLength(kSampleSize)
+  size_t compressed = 0;
+
+  for (size_t i = 0; i < kSampleCount; i++)
+  {
+    const char *sample = data + i * ((length - kSampleSize) / (kSampleCount - 1));
+    compressed += CompressFragment(sample, kSampleSize, scratch, kLevelFast) - scratch;
+  }
+
+  return Pays(compressed, kSampleCount * kSampleSize);
+}
+
+size_t Context::Compress(const char *data, size_t length, char *dst, int level, bool adaptive, size_t *stored)
+{
+  char *op = EncodeVarint32(dst, static_cast<uint32_t>(length));
+  size_t storedLength = 0;
+
+  while (length > 0)
+  {
+    size_t blockLength = std::min(length, snappy::kBlockSize);
+    if (!adaptive)
+    {
+      op = CompressFragment(data, blockLength, op, level);
+    }
+    else if (blockLength >= kMinSampledLength && !SamplesCompress(data, blockLength))
+    {
+      op = EmitLiteral(op, data, blockLength);
+      storedLength += blockLength;
+    }
+    else
+    {
+      char *end = CompressFragment(data, blockLength, op, level);
+      if (Pays(end - op, blockLength))
+      {
+        op = end;
+      }
+      else
+      {
+        op = EmitLiteral(op, data, blockLength);
+        storedLength += blockLength;
+      }
+    }
+    data += blockLength;
+    length -= blockLength;
+  }
+
+  if (stored != NULL)
+    *stored += storedLength;
+  return op - dst;
+}
+
+char *Context::CompressToHeap(const char *data, size_t length, size_t *dstLength, int level, bool adaptive,
+                              size_t *stored)
+{
+  char *dst = static_cast<char *>(malloc(snappy::MaxCompressedLength(length)));
+  if (dst == NULL)
+    return NULL;
+
+  *dstLength = Compress(data, length, dst, level, adaptive, stored);
+
+  char *trimmed = static_cast<char *>(realloc(dst, *dstLength > 0 ? *dstLength : 1));
+  return trimmed != NULL ? trimmed : dst;
+}
+
+const char *Context::CompressToScratch(const char *data, size_t length, size_t *dstLength, int level,
+                                       bool adaptive, size_t *stored)
+{
+  size_t bound = snappy::MaxCompressedLength(length);
+  if (bound > scratchSize || (scratchSize > kScratchKept && bound <= kScratchKept))
+  {
+    free(scratch);
+    scratchSize = std::max(bound, std::min(scratchSize, kScratchKept));
+    scratch = static_cast<char *>(malloc(scratchSize));
+    if (scratch == NULL)
+    {
+      scratchSize = 0;
+      return NULL;
+    }
+  }
+
+  *dstLength = Compress(data, length, scratch, level, adaptive, stored);
+  return scratch;
+}
+
+bool Context::CompressInto(const char *data, size_t length, char *dst, size_t capacity, size_t *written,
+                           int level)
+{
+  if (capacity >= snappy::MaxCompressedLength(length))
+  {
+    *written = Compress(data, length, dst, level);
+    return true;
+  }
+
+  char header[5];
+  size_t headerLength = EncodeVarint32(header, static_cast<uint32_t>(length)) - header;
+  if (headerLength > capacity)
+    return false;
+  memcpy(dst, header, headerLength);
+
+  char *op = dst + headerLength;
+  char *end = dst + capacity;
+
+  while (length > 0)
+  {
+    size_t blockLength = std::min(length, snappy::kBlockSize);
+
+    if (static_cast<size_t>(end - op) >= snappy::MaxCompressedLength(blockLength))
+    {
+      op = CompressFragment(data, blockLength, op, level);
+    }
+    else
+    {
+      char *scratch = wmem->GetScratchOutput();
+      size_t n = CompressFragment(data, blockLength, scratch, level) - scratch;
+      if (n > static_cast<size_t>(end - op))
+        return false;
+      memcpy(op, scratch, n);
+      op += n;
+    }
+
+    data += blockLength;
+    length -= blockLength;
+  }
+
+  *written = op - dst;
+  return true;
+}
+
+Context &ThreadContext()
+{
+  static thread_local Context context;
+  return context;
+}
+
+const char *UncompressToHeap(const char *data, size_t length, char **dst, size_t *dstLength)
+{
+  *dst = NULL;
+  if (!snappy::GetUncompressedLength(data, length, dstLength))
+    return "Invalid input";
+
+  *dst = static_cast<char *>(malloc(*dstLength > 0 ? *dstLength : 1));
+  if (*dst == NULL)
+    return "Out of memory";
+
+  if (!kernels::RawUncompress(data, length, *dst))
+  {
+    free(*dst);
+    *dst = NULL;
+    return "Invalid input";
+  }
+
+  return NULL;
+}
+
+BatchOutput::BatchOutput()
+    : data(NULL), length(0), offsets(NULL) {}
+
+BatchOutput::~BatchOutput()
+{
+  free(data);
+  free(offsets);
+}
+
+const char *CompressSlices(const std::vector<Slice> &inputs, BatchOutput *out, int level)
+{
+  size_t bound = 1;
+  for (size_t i = 0; i < inputs.size(); i++)
+    bound += snappy::MaxCompressedLength(inputs[i].length);
+
+  out->data = static_cast<char *>(malloc(bound));
+  out->offsets = static_cast<double *>(malloc((inputs.size() + 1) * sizeof(double)));
+  if (out->data == NULL || out->offsets == NULL)
+    return "Out of memory";
+
+  Context &context = ThreadContext();
+  size_t offset = 0;
+  for (size_t i = 0; i < inputs.size(); i++)
+  {
+    out->offsets[i] = static_cast<double>(offset);
+    offset += context.Compress(inputs[i].data, inputs[i].length, out->data + offset, level);
+  }
+  out->offsets[inputs.size()] = static_cast<double>(offset);
+  out->length = offset;
+
+  char *trimmed = static_cast<char *>(realloc(out->data, offset > 0 ? offset : 1));
+  if (trimmed != NULL)
+    out->data = trimmed;
+  return NULL;
+}
+
+const char *UncompressSlices(const std::vector<Slice> &inputs, BatchOutput *out)
+{
+  out->offsets = static_cast<double *>(malloc((inputs.size() + 1) * sizeof(double)));
+  if (out->offsets == NULL)
+    return "Out of memory";
+
+  size_t total = 0;
+  for (size_t i = 0; i < inputs.size(); i++)
+  {
+    size_t length;
+    if (!snappy::GetUncompressedLength(inputs[i].data, inputs[i].length, &length))
+      return "Invalid input";
+    out->offsets[i] = static_cast<double>(total);
+    total += length;
+  }
+  out->offsets[inputs.size()] = static_cast<double>(total);
+
+  out->data = static_cast<char *>(malloc(total > 0 ? total : 1));
+  if (out->data == NULL)
+    return "Out of memory";
+  out->length = total;
+
+  for (size_t i = 0; i < inputs.size(); i++)
+  {
+    char *dst = out->data + static_cast<size_t>(out->offsets[i]);
+    if (!kernels::RawUncompress(inputs[i].data, inputs[i].length, dst))
+      return "Invalid input";
+  }
+  return NULL;
+}
+
+} // namespace nodesnappy
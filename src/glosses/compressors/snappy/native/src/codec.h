@@ -0,0 +1,128 @@
+#ifndef __NODESNAPPY_CODEC_H_
+#define __NODESNAPPY_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "fragment.h"
+
+namespace snappy
+{
+namespace internal
+{
+class WorkingMemory;
+} // namespace internal
+} // namespace snappy
+
+// Block compression helpers of the binding. Everything here works on plain
+// memory and may run off the main thread.
+
+namespace nodesnappy
+{
+
+extern const char *kNotEnoughSpace;
+extern const char *kOutputTooLarge;
+
+// Returns true if every byte is below 0x80, so the data reads the same as
+// UTF-8 and as Latin-1.
+bool IsAscii(const char *data, size_t length);
+
+// Compression state that is kept across calls: the hash table and scratch
+// buffers of snappy are allocated once, instead of on every compression. A
+// context must not be used by more than one thread at a time.
+class Context
+{
+public:
+  Context();
+  ~Context();
+
+  // Compresses at the given level, see fragment.h. The default level gives
+  // the same output as snappy::RawCompress(). dst must hold
+  // MaxCompressedLength(length) bytes. Returns the number of bytes written.
+  //
+  // In adaptive mode, blocks that do not compress are stored as a single
+  // literal instead, which any snappy decoder reads and which decodes with
+  // one memcpy(). Large blocks are judged by compressing a few samples on
+  // trial, so already compressed data costs a fraction of a compression;
+  // the others are compressed and stored if that did not pay. The number of
+  // input bytes stored is added to *stored when it is given.
+  size_t Compress(const char *data, size_t length, char *dst, int level = kLevelDefault, bool adaptive = false,
+                  size_t *stored = NULL);
+
+  // Compresses into a single allocation sized by MaxCompressedLength() and
+  // trimmed to the actual output size. Returns NULL when out of memory.
+  char *CompressToHeap(const char *data, size_t length, size_t *dstLength, int level = kLevelDefault,
+                       bool adaptive = false, size_t *stored = NULL);
+
+  // Compresses into an output block of the context, which the next call
+  // reuses, and returns it; for results that are copied right away. A block
+  // grown beyond 1 MB is given back on the next smaller call. Returns NULL
+  // when out of memory.
+  const char *CompressToScratch(const char *data, size_t length, size_t *dstLength, int level = kLevelDefault,
+                                bool adaptive = false, size_t *stored = NULL);
+
+  // Compresses into [dst, dst + capacity). Blocks are compressed directly
+  // into the range while it can hold their worst case, otherwise through
+  // the scratch output. Returns false when the output does not fit.
+  bool CompressInto(const char *data, size_t length, char *dst, size_t capacity, size_t *written,
+                    int level = kLevelDefault);
+
+private:
+  Context(const Context &);
+  void operator=(const Context &);
+
+  // Compresses a fragment of at most kBlockSize bytes, returns its end.
+  char *CompressFragment(const char *data, size_t length, char *op, int level);
+
+  // Whether samples of a fragment compress well enough to compress it all.
+  bool SamplesCompress(const char *data, size_t length);
+
+  snappy::internal::WorkingMemory *wmem;
+  uint16_t *buckets; // two-way hash table of the best level, on first use
+  char *scratch;     // output of CompressToScratch()
+  size_t scratchSize;
+};
+
+// Context of the calling thread, created on first use. Worker threads keep
+// theirs for their whole lifetime.
+Context &ThreadContext();
+
+// Uncompresses into a single allocation of exactly the size recorded in the
+// stream header. Returns an error message, or NULL on success.
+const char *UncompressToHeap(const char *data, size_t length, char **dst, size_t *dstLength);
+
+struct Slice
+{
+  const char *data;
+  size_t length;
+};
+
+// Output of a batch: all results back to back in one block, plus the offset
+// of every result and the end of the last one (inputs.size() + 1 entries).
+struct BatchOutput
+{
+  BatchOutput();
+  ~BatchOutput();
+
+  char *data;
+  size_t length;
+  double *offsets;
+
+private:
+  BatchOutput(const BatchOutput &);
+  void operator=(const BatchOutput &);
+};
+
+// Compresses every input into a single allocation bounded by the sum of
+// MaxCompressedLength() of the inputs. Returns an error message or NULL.
+const char *CompressSlices(const std::vector<Slice> &inputs, BatchOutput *out, int level = kLevelDefault);
+
+// Uncompresses every input into a single allocation of the exact total size.
+// Returns an error message or NULL.
+const char *UncompressSlices(const std::vector<Slice> &inputs, BatchOutput *out);
+
+} // namespace nodesnappy
+
+#endif // __NODESNAPPY_CODEC_H_
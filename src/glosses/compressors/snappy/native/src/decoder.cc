@@ -0,0 +1,224 @@
+#include "decoder.h"
+
+#include "codec.h"
+
+#include <stdlib.h>
+#include <string.h> // memcpy
+
+#include <algorithm>
+
+namespace nodesnappy
+{
+
+namespace
+{
+
+const char *kInvalidInput = "Invalid input";
+
+// Element types, the low two bits of the tag byte.
+enum
+{
+  kLiteral = 0,
+  kCopy1ByteOffset = 1,
+  kCopy2ByteOffset = 2,
+  kCopy4ByteOffset = 3
+};
+
+inline uint32_t LoadLE(const char *p, size_t bytes)
+{
+  uint32_t value = 0;
+  for (size_t i = 0; i < bytes; i++)
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+  return value;
+}
+
+// Size of the element header starting with the tag, literal bytes excluded.
+inline size_t ElementSize(char tag)
+{
+  uint8_t c = static_cast<uint8_t>(tag);
+  switch (c & 3)
+  {
+  case kLiteral:
+    return (c >> 2) < 60 ? 1 : 1 + (c >> 2) - 59;
+  case kCopy1ByteOffset:
+    return 2;
+  case kCopy2ByteOffset:
+    return 3;
+  default:
+    return 5;
+  }
+}
+
+} // namespace
+
+Decoder::Decoder(size_t maxOutput, OutputAllocator *allocator)
+    : maxOutput(maxOutput), headerRead(false), shift(0), length(0), allocator(allocator), output(NULL), produced(0),
+      pendingLength(0), literalLeft(0), error(NULL) {}
+
+Decoder::~Decoder()
+{
+  if (allocator == NULL)
+    free(output);
+}
+
+const char *Decoder::ReadHeader(const char **ip, const char *end)
+{
+  while (*ip < end)
+  {
+    uint8_t c = static_cast<uint8_t>(*(*ip)++);
+    uint32_t value = c & 0x7f;
+    if (shift >= 32 || ((value << shift) >> shift) != value)
+      return kInvalidInput;
+
+    length |= static_cast<size_t>(value) << shift;
+    if (c < 128)
+    {
+      headerRead = true;
+      if (length > maxOutput)
+        return kOutputTooLarge;
+      if (length > 0)
+      {
+        output = allocator != NULL ? allocator->Allocate(length) : static_cast<char *>(malloc(length));
+        if (output == NULL)
+          return "Out of memory";
+      }
+      return NULL;
+    }
+    shift += 7;
+  }
+
+  return NULL;
+}
+
+const char *Decoder::Copy(size_t offset, size_t count)
+{
+  if (offset == 0 || offset > produced || count > length - produced)
+    return kInvalidInput;
+
+  // Overlapping copies repeat the last offset bytes. The distance to the
+  // source doubles with every round, so each memcpy() copies twice as much.
+  char *op = output + produced;
+  const char *src = op - offset;
+  for (size_t left = count; left > 0;)
+  {
+    size_t n = std::min(left, static_cast<size_t>(op - src));
+    memcpy(op, src, n);
+    op += n;
+    left -= n;
+  }
+
+  produced += count;
+  return NULL;
+}
+
+const char *Decoder::ReadElement(const char *element, size_t *literal)
+{
+  uint8_t tag = static_cast<uint8_t>(element[0]);
+  *literal = 0;
+
+  switch (tag & 3)
+  {
+  case kLiteral:
+  {
+    size_t count = tag >> 2;
+    if (count >= 60)
+      count = LoadLE(element + 1, count - 59);
+    count++;
+    if (count > length - produced)
+      return kInvalidInput;
+    *literal = count;
+    return NULL;
+  }
+
+  case kCopy1ByteOffset:
+    return Copy(((tag >> 5) << 8) | static_cast<uint8_t>(element[1]), 4 + ((tag >> 2) & 7));
+
+  case kCopy2ByteOffset:
+    return Copy(LoadLE(element + 1, 2), (tag >> 2) + 1);
+
+  default:
+    return Copy(LoadLE(element + 1, 4), (tag >> 2) + 1);
+  }
+}
+
+const char *Decoder::Push(const char *data, size_t dataLength)
+{
+  // The state is undefined after an error, e.g. the output may be missing.
+  if (error == NULL)
+    error = Decode(data, dataLength);
+  return error;
+}
+
+const char *Decoder::Decode(const char *data, size_t dataLength)
+{
+  const char *ip = data;
+  const char *end = data + dataLength;
+  const char *err;
+
+  if (!headerRead)
+  {
+    err = ReadHeader(&ip, end);
+    if (err != NULL)
+      return err;
+  }
+
+  while (ip < end)
+  {
+    if (literalLeft > 0)
+    {
+      size_t n = std::min(literalLeft, static_cast<size_t>(end - ip));
+      memcpy(output + produced, ip, n);
+      produced += n;
+      literalLeft -= n;
+      ip += n;
+      continue;
+    }
+
+    // Anything after the last element is invalid.
+    if (produced == length)
+      return kInvalidInput;
+
+    size_t literal;
+    if (pendingLength > 0)
+    {
+      size_t size = ElementSize(pending[0]);
+      size_t n = std::min(size - pendingLength, static_cast<size_t>(end - ip));
+      memcpy(pending + pendingLength, ip, n);
+      pendingLength += n;
+      ip += n;
+      if (pendingLength < size)
+        return NULL;
+
+      pendingLength = 0;
+      err = ReadElement(pending, &literal);
+    }
+    else
+    {
+      size_t size = ElementSize(*ip);
+      if (static_cast<size_t>(end - ip) < size)
+      {
+        pendingLength = end - ip;
+        memcpy(pending, ip, pendingLength);
+        return NULL;
+      }
+
+      err = ReadElement(ip, &literal);
+      ip += size;
+    }
+
+    if (err != NULL)
+      return err;
+    literalLeft = literal;
+  }
+
+  return NULL;
+}
+
+const char *Decoder::Finish() const
+{
+  if (error != NULL)
+    return error;
+  return headerRead && produced == length ? NULL : "Unexpected end of input";
+}
+
+} // namespace nodesnappy
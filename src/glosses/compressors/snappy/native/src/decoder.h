@@ -0,0 +1,85 @@
+#ifndef __NODESNAPPY_DECODER_H_
+#define __NODESNAPPY_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <limits>
+
+// Incremental decoder of a single snappy compressed block, for input that
+// arrives in pieces. snappy's own decompressor takes the end of its source
+// for the end of the input, so it cannot be suspended in the middle of a
+// block; this one keeps its state between calls instead. The output is
+// allocated at once when the length header is complete, then filled as the
+// elements of the block arrive, so decoded data is available right away.
+
+namespace nodesnappy
+{
+
+// Provides the output of a Decoder, which then does not free it.
+class OutputAllocator
+{
+public:
+  virtual ~OutputAllocator() {}
+
+  // Returns length bytes (never 0) that stay valid as long as the decoder,
+  // or NULL when out of memory.
+  virtual char *Allocate(size_t length) = 0;
+};
+
+class Decoder
+{
+public:
+  // Blocks longer than maxOutput bytes fail with kOutputTooLarge before any
+  // output is allocated. The output is malloc'ed unless an allocator is given.
+  explicit Decoder(size_t maxOutput = std::numeric_limits<size_t>::max(), OutputAllocator *allocator = NULL);
+  ~Decoder();
+
+  // Decodes as far as the input allows. Elements split between calls are
+  // completed on the next call; besides the few bytes of a split element
+  // header nothing is copied. Returns an error message, or NULL on success.
+  // An error is final: every later call returns it again.
+  const char *Push(const char *data, size_t length);
+
+  // Returns an error message if the block is not complete.
+  const char *Finish() const;
+
+  // Output of uncompressed length bytes, NULL until the length header has
+  // been read (and for an empty output). Bytes up to Produced() are final.
+  char *Output() const { return output; }
+  size_t Produced() const { return produced; }
+  bool HasLength() const { return headerRead; }
+  size_t Length() const { return length; }
+
+private:
+  Decoder(const Decoder &);
+  void operator=(const Decoder &);
+
+  const char *Decode(const char *data, size_t length);
+  const char *ReadHeader(const char **ip, const char *end);
+  const char *ReadElement(const char *element, size_t *literal);
+  const char *Copy(size_t offset, size_t count);
+
+  size_t maxOutput;
+
+  // Length header, a varint of at most 5 bytes.
+  bool headerRead;
+  uint32_t shift;
+  size_t length;
+
+  OutputAllocator *allocator;
+  char *output;
+  size_t produced;
+
+  // Element header split between calls, and the literal bytes still to come.
+  char pending[5];
+  size_t pendingLength;
+  size_t literalLeft;
+
+  // First error, NULL while there is none.
+  const char *error;
+};
+
+} // namespace nodesnappy
+
+#endif // __NODESNAPPY_DECODER_H_
@@ -0,0 +1,237 @@
+#include "fragment.h"
+
+#include <snappy.h>
+#include <snappy-internal.h>
+
+#include <string.h> // memcpy
+
+namespace nodesnappy
+{
+
+namespace
+{
+
+// Matches are only searched while this many bytes are left, so that 8 byte
+// loads never read past the input. The same margin as snappy's.
+const size_t kInputMarginBytes = 15;
+
+inline uint32_t Load32(const char *p)
+{
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// Same hash function as snappy's.
+inline uint32_t Hash(const char *p, int shift)
+{
+  return (Load32(p) * 0x1e35a7bd) >> shift;
+}
+
+// Shift that maps a hash to a bucket of a table of the given size, which
+// is a power of two.
+inline int TableShift(int tableSize)
+{
+  int bits = 0;
+  while ((1 << bits) < tableSize)
+    bits++;
+  return 32 - bits;
+}
+
+inline size_t MatchLength(const char *candidate, const char *ip, const char *end)
+{
+  return snappy::internal::FindMatchLength(candidate, ip, end).first;
+}
+
+char *EmitLiteral(char *op, const char *literal, size_t length)
+{
+  if (length == 0)
+    return op;
+
+  size_t n = length - 1;
+  if (n < 60)
+  {
+    *op++ = static_cast<char>(n << 2);
+  }
+  else
+  {
+    // Tags 60 to 63 are followed by 1 to 4 bytes of length.
+    char *tag = op++;
+    int count = 0;
+    for (; n > 0; n >>= 8, count++)
+      *op++ = static_cast<char>(n & 0xff);
+    *tag = static_cast<char>((59 + count) << 2);
+  }
+
+  memcpy(op, literal, length);
+  return op + length;
+}
+
+inline char *EmitCopyWithOffset2(char *op, size_t offset, size_t length)
+{
+  *op++ = static_cast<char>(2 | ((length - 1) << 2));
+  *op++ = static_cast<char>(offset & 0xff);
+  *op++ = static_cast<char>(offset >> 8);
+  return op;
+}
+
+char *EmitCopy(char *op, size_t offset, size_t length)
+{
+  // A copy holds up to 64 bytes. Split long ones so the last part still
+  // has the 4 bytes that the short encoding needs.
+  while (length >= 68)
+  {
+    op = EmitCopyWithOffset2(op, offset, 64);
+    length -= 64;
+  }
+  if (length > 64)
+  {
+    op = EmitCopyWithOffset2(op, offset, 60);
+    length -= 60;
+  }
+
+  if (length < 12 && offset < 2048)
+  {
+    *op++ = static_cast<char>(1 | ((length - 4) << 2) | ((offset >> 8) << 5));
+    *op++ = static_cast<char>(offset & 0xff);
+    return op;
+  }
+  return EmitCopyWithOffset2(op, offset, length);
+}
+
+// Looks up both candidates of the bucket of ip and stores ip as the newest
+// one. Returns the length of the longer match, 0 if there is none.
+inline size_t FindBestMatch(const char *input, const char *ip, const char *end,
+                            uint16_t *table, int shift, const char **match)
+{
+  uint16_t *bucket = table + 2 * Hash(ip, shift);
+  size_t best = 0;
+
+  for (int i = 0; i < 2; i++)
+  {
+    const char *candidate = input + bucket[i];
+    if (Load32(candidate) != Load32(ip))
+      continue;
+    size_t matched = 4 + MatchLength(candidate + 4, ip + 4, end);
+    if (matched > best)
+    {
+      best = matched;
+      *match = candidate;
+    }
+  }
+
+  bucket[1] = bucket[0];
+  bucket[0] = static_cast<uint16_t>(ip - input);
+  return best;
+}
+
+inline void Insert(const char *input, const char *ip, uint16_t *table, int shift)
+{
+  uint16_t *bucket = table + 2 * Hash(ip, shift);
+  bucket[1] = bucket[0];
+  bucket[0] = static_cast<uint16_t>(ip - input);
+}
+
+} // namespace
+
+char *CompressFragmentFast(const char *input, size_t length, char *op, uint16_t *table, int tableSize)
+{
+  const char *ip = input;
+  const char *end = input + length;
+  const char *literal = input;
+
+  if (length >= kInputMarginBytes)
+  {
+    const char *limit = end - kInputMarginBytes;
+    const int shift = TableShift(tableSize);
+
+    // The step between lookups grows by one every 16 bytes without a match,
+    // where snappy waits for 32.
+    uint32_t skip = 16;
+
+    for (ip++; ip < limit;)
+    {
+      uint32_t hash = Hash(ip, shift);
+      const char *candidate = input + table[hash];
+      table[hash] = static_cast<uint16_t>(ip - input);
+
+      if (Load32(candidate) != Load32(ip))
+      {
+        uint32_t step = skip >> 4;
+        skip += step;
+        ip += step;
+        continue;
+      }
+
+      size_t matched = 4 + MatchLength(candidate + 4, ip + 4, end);
+      op = EmitLiteral(op, literal, ip - literal);
+      op = EmitCopy(op, ip - candidate, matched);
+      ip += matched;
+      literal = ip;
+      skip = 16;
+
+      if (ip < limit)
+        table[Hash(ip - 1, shift)] = static_cast<uint16_t>(ip - 1 - input);
+    }
+  }
+
+  return EmitLiteral(op, literal, end - literal);
+}
+
+char *CompressFragmentBest(const char *input, size_t length, char *op, uint16_t *table, int tableSize)
+{
+  const char *ip = input;
+  const char *end = input + length;
+  const char *literal = input;
+
+  if (length >= kInputMarginBytes)
+  {
+    const char *limit = end - kInputMarginBytes;
+    const int shift = TableShift(tableSize);
+
+    // The step between lookups grows by one every 64 bytes without a match.
+    uint32_t skip = 64;
+
+    for (ip++; ip < limit;)
+    {
+      const char *candidate;
+      size_t matched = FindBestMatch(input, ip, end, table, shift, &candidate);
+
+      if (matched == 0)
+      {
+        uint32_t step = skip >> 6;
+        skip += step;
+        ip += step;
+        continue;
+      }
+
+      // Take the match one byte later instead while it is longer.
+      while (ip + 1 < limit)
+      {
+        const char *next;
+        size_t nextMatched = FindBestMatch(input, ip + 1, end, table, shift, &next);
+        if (nextMatched <= matched)
+          break;
+        ip++;
+        candidate = next;
+        matched = nextMatched;
+      }
+
+      op = EmitLiteral(op, literal, ip - literal);
+      op = EmitCopy(op, ip - candidate, matched);
+
+      // Index the matched bytes too; ip and ip + 1 already are.
+      const char *matchEnd = ip + matched;
+      for (const char *p = ip + 2; p < matchEnd && p < limit; p++)
+        Insert(input, p, table, shift);
+
+      ip = matchEnd;
+      literal = ip;
+      skip = 64;
+    }
+  }
+
+  return EmitLiteral(op, literal, end - literal);
+}
+
+} // namespace nodesnappy
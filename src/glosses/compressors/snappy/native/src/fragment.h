@@ -0,0 +1,36 @@
+#ifndef __NODESNAPPY_FRAGMENT_H_
+#define __NODESNAPPY_FRAGMENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fragment compressors for the compression levels besides the default one,
+// which is snappy::internal::CompressFragment. All of them produce standard
+// snappy output and have the same contract: input is at most kBlockSize
+// bytes, op has room for MaxCompressedLength(length) bytes, the table is
+// zeroed, and the end of the output is returned.
+
+namespace nodesnappy
+{
+
+enum Level
+{
+  kLevelFast = 1,
+  kLevelDefault = 2,
+  kLevelBest = 3
+};
+
+// Hash table entries used by the fast level; the table fits into L1.
+static const size_t kFastTableSize = 1 << 10;
+
+// Looks at fewer positions than the default and gives up on data that does
+// not compress twice as quickly. tableSize is at most kFastTableSize.
+char *CompressFragmentFast(const char *input, size_t length, char *op, uint16_t *table, int tableSize);
+
+// Keeps two candidates per hash bucket and tries a match one byte later
+// before taking one (lazy matching). The table holds 2 * tableSize entries.
+char *CompressFragmentBest(const char *input, size_t length, char *op, uint16_t *table, int tableSize);
+
+} // namespace nodesnappy
+
+#endif // __NODESNAPPY_FRAGMENT_H_
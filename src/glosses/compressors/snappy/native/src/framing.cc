@@ -0,0 +1,381 @@
+#include "framing.h"
+
+#include "codec.h"
+#include "kernels.h"
+
+#include "crc32.h"
+
+#include <snappy.h>
+
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcpy, memcmp
+
+#include <algorithm>
+#include <vector>
+
+namespace nodesnappy
+{
+namespace framing
+{
+
+namespace
+{
+
+const unsigned char kCompressedData = 0x00;
+const unsigned char kUncompressedData = 0x01;
+const unsigned char kSkippableFirst = 0x80;
+const unsigned char kStreamIdentifier = 0xff;
+
+const char kStreamIdentifierChunk[kStreamIdentifierSize] = {
+    '\xff', '\x06', '\x00', '\x00', 's', 'N', 'a', 'P', 'p', 'Y'};
+
+// Largest chunk body that the decoder buffers, anything bigger is invalid.
+const size_t kMaxDataChunkLength = kChecksumSize + 76490; // MaxCompressedLength(kMaxBlockSize)
+
+inline void StoreLE32(char *dst, uint32_t value)
+{
+  dst[0] = static_cast<char>(value);
+  dst[1] = static_cast<char>(value >> 8);
+  dst[2] = static_cast<char>(value >> 16);
+  dst[3] = static_cast<char>(value >> 24);
+}
+
+inline uint32_t LoadLE32(const char *src)
+{
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(src);
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline void StoreChunkHeader(char *dst, unsigned char type, size_t length)
+{
+  StoreLE32(dst, type | (static_cast<uint32_t>(length) << 8));
+}
+
+inline unsigned char ChunkType(const char *chunk)
+{
+  return static_cast<unsigned char>(chunk[0]);
+}
+
+inline size_t ChunkLength(const char *chunk)
+{
+  return LoadLE32(chunk) >> 8;
+}
+
+inline bool IsSkippable(const char *chunk)
+{
+  return ChunkType(chunk) >= kSkippableFirst && ChunkType(chunk) != kStreamIdentifier;
+}
+
+// Validates a chunk header before its body is buffered.
+const char *CheckHeader(const char *chunk, bool identified)
+{
+  unsigned char type = ChunkType(chunk);
+  size_t length = ChunkLength(chunk);
+
+  if (type == kStreamIdentifier)
+  {
+    return length == kStreamIdentifierSize - kChunkHeaderSize ? NULL : "Invalid stream identifier";
+  }
+  if (!identified)
+  {
+    return "Missing stream identifier";
+  }
+  if (type == kCompressedData || type == kUncompressedData)
+  {
+    return length >= kChecksumSize && length <= kMaxDataChunkLength ? NULL : "Invalid chunk length";
+  }
+  if (type < kSkippableFirst)
+  {
+    return "Unsupported unskippable chunk";
+  }
+  return NULL;
+}
+
+// Validates a complete chunk and returns the size of its decoded data.
+const char *MeasureChunk(const char *chunk, bool *identified, size_t *uncompressedLength)
+{
+  const char *body = chunk + kChunkHeaderSize;
+  size_t length = ChunkLength(chunk);
+
+  *uncompressedLength = 0;
+
+  switch (ChunkType(chunk))
+  {
+  case kStreamIdentifier:
+    if (memcmp(chunk, kStreamIdentifierChunk, kStreamIdentifierSize) != 0)
+      return "Invalid stream identifier";
+    *identified = true;
+    return NULL;
+
+  case kCompressedData:
+    if (!snappy::GetUncompressedLength(body + kChecksumSize, length - kChecksumSize, uncompressedLength) ||
+        *uncompressedLength > kMaxBlockSize)
+      return "Invalid compressed chunk";
+    return NULL;
+
+  case kUncompressedData:
+    *uncompressedLength = length - kChecksumSize;
+    return *uncompressedLength <= kMaxBlockSize ? NULL : "Invalid uncompressed chunk";
+
+  default:
+    return NULL;
+  }
+}
+
+const char *DecodeChunk(const char *chunk, char *dst, size_t *written)
+{
+  const char *body = chunk + kChunkHeaderSize;
+  size_t length = ChunkLength(chunk) - kChecksumSize;
+
+  switch (ChunkType(chunk))
+  {
+  case kCompressedData:
+    if (!snappy::GetUncompressedLength(body + kChecksumSize, length, written) ||
+        !kernels::RawUncompress(body + kChecksumSize, length, dst))
+      return "Invalid compressed chunk";
+    break;
+
+  case kUncompressedData:
+    if (length > 0)
+      memcpy(dst, body + kChecksumSize, length);
+    *written = length;
+    break;
+
+  default:
+    *written = 0;
+    return NULL;
+  }
+
+  return LoadLE32(body) == MaskedCrc32c(dst, *written) ? NULL : "Checksum mismatch";
+}
+
+} // namespace
+
+uint32_t MaskedCrc32c(const char *data, size_t length)
+{
+  uint32_t crc = adone::crc::Crc32c(data, length);
+  return ((crc >> 15) | (crc << 17)) + 0xa282ead8;
+}
+
+size_t MaxFramedLength(size_t length)
+{
+  size_t blocks = (length + kMaxBlockSize - 1) / kMaxBlockSize;
+  return blocks * (kChunkHeaderSize + kChecksumSize + snappy::MaxCompressedLength(kMaxBlockSize));
+}
+
+size_t WriteStreamIdentifier(char *dst)
+{
+  memcpy(dst, kStreamIdentifierChunk, kStreamIdentifierSize);
+  return kStreamIdentifierSize;
+}
+
+size_t FrameCompressBlock(const char *data, size_t length, char *dst, int level)
+{
+  char *body = dst + kChunkHeaderSize + kChecksumSize;
+  StoreLE32(dst + kChunkHeaderSize, MaskedCrc32c(data, length));
+  size_t compressedLength = ThreadContext().Compress(data, length, body, level);
+
+  // Store the block as is when compression does not save at least 1/8.
+  if (compressedLength < length - length / 8)
+  {
+    StoreChunkHeader(dst, kCompressedData, kChecksumSize + compressedLength);
+  }
+  else
+  {
+    memcpy(body, data, length);
+    compressedLength = length;
+    StoreChunkHeader(dst, kUncompressedData, kChecksumSize + length);
+  }
+
+  return kChunkHeaderSize + kChecksumSize + compressedLength;
+}
+
+size_t FrameCompress(const char *data, size_t length, char *dst, int level)
+{
+  char *start = dst;
+
+  while (length > 0)
+  {
+    size_t blockLength = std::min(length, kMaxBlockSize);
+    dst += FrameCompressBlock(data, blockLength, dst, level);
+    data += blockLength;
+    length -= blockLength;
+  }
+
+  return dst - start;
+}
+
+const char *ScanFrames(const char *data, size_t length, std::vector<DataChunk> *chunks, size_t *uncompressedLength)
+{
+  const char *err;
+  bool identified = false;
+
+  chunks->clear();
+  *uncompressedLength = 0;
+
+  while (length > 0)
+  {
+    if (length < kChunkHeaderSize)
+      return "Unexpected end of stream";
+    if ((err = CheckHeader(data, identified)) != NULL)
+      return err;
+
+    size_t chunkLength = kChunkHeaderSize + ChunkLength(data);
+    if (chunkLength > length)
+      return "Unexpected end of stream";
+
+    if (!IsSkippable(data))
+    {
+      size_t dataLength;
+      if ((err = MeasureChunk(data, &identified, &dataLength)) != NULL)
+        return err;
+      if (dataLength > 0)
+      {
+        DataChunk chunk = {data, *uncompressedLength};
+        chunks->push_back(chunk);
+        *uncompressedLength += dataLength;
+      }
+      else if ((err = DecodeDataChunk(data, NULL)) != NULL)
+      {
+        // Data chunks without data still carry a checksum to verify.
+        return err;
+      }
+    }
+
+    data += chunkLength;
+    length -= chunkLength;
+  }
+
+  return NULL;
+}
+
+const char *DecodeDataChunk(const char *chunk, char *dst)
+{
+  size_t written;
+  return DecodeChunk(chunk, dst, &written);
+}
+
+FrameDecoder::FrameDecoder()
+    : skipping(0), identified(false) {}
+
+const char *FrameDecoder::Push(const char *data, size_t length, char **out, size_t *outLength)
+{
+  const char *err;
+
+  *out = NULL;
+  *outLength = 0;
+
+  // Drop the rest of a skippable chunk.
+  size_t skipped = std::min(skipping, length);
+  skipping -= skipped;
+  data += skipped;
+  length -= skipped;
+
+  // Complete the chunk left over from the previous call.
+  bool pendingComplete = false;
+  if (!pending.empty())
+  {
+    if (pending.size() < kChunkHeaderSize)
+    {
+      size_t take = std::min(kChunkHeaderSize - pending.size(), length);
+      pending.append(data, take);
+      data += take;
+      length -= take;
+      if (pending.size() < kChunkHeaderSize)
+        return NULL;
+      if ((err = CheckHeader(pending.data(), identified)) != NULL)
+        return err;
+    }
+
+    if (IsSkippable(pending.data()))
+    {
+      skipping = ChunkLength(pending.data());
+      pending.clear();
+      skipped = std::min(skipping, length);
+      skipping -= skipped;
+      data += skipped;
+      length -= skipped;
+    }
+    else
+    {
+      size_t need = kChunkHeaderSize + ChunkLength(pending.data()) - pending.size();
+      size_t take = std::min(need, length);
+      pending.append(data, take);
+      data += take;
+      length -= take;
+      if (take < need)
+        return NULL;
+      pendingComplete = true;
+    }
+  }
+
+  // First pass: find the complete chunks and the size of their output.
+  std::vector<const char *> complete;
+  size_t total = 0;
+  size_t uncompressedLength;
+
+  if (pendingComplete)
+  {
+    if ((err = MeasureChunk(pending.data(), &identified, &uncompressedLength)) != NULL)
+      return err;
+    complete.push_back(pending.data());
+    total += uncompressedLength;
+  }
+
+  while (skipping == 0 && length >= kChunkHeaderSize)
+  {
+    if ((err = CheckHeader(data, identified)) != NULL)
+      return err;
+
+    size_t chunkLength = kChunkHeaderSize + ChunkLength(data);
+    if (IsSkippable(data))
+    {
+      skipped = std::min(chunkLength, length);
+      skipping = chunkLength - skipped;
+      data += skipped;
+      length -= skipped;
+      continue;
+    }
+    if (chunkLength > length)
+      break;
+
+    if ((err = MeasureChunk(data, &identified, &uncompressedLength)) != NULL)
+      return err;
+    complete.push_back(data);
+    total += uncompressedLength;
+    data += chunkLength;
+    length -= chunkLength;
+  }
+
+  // Second pass: decode into a single block of the exact size. Chunks
+  // without data are decoded too, for their checksum.
+  char *dst = NULL;
+  if (total > 0 && (dst = static_cast<char *>(malloc(total))) == NULL)
+    return "Out of memory";
+
+  size_t offset = 0;
+  for (size_t i = 0; i < complete.size(); i++)
+  {
+    size_t written;
+    if ((err = DecodeChunk(complete[i], dst + offset, &written)) != NULL)
+    {
+      free(dst);
+      return err;
+    }
+    offset += written;
+  }
+
+  *out = dst;
+  *outLength = total;
+
+  pending.assign(data, length);
+  return NULL;
+}
+
+const char *FrameDecoder::Finish() const
+{
+  return pending.empty() && skipping == 0 ? NULL : "Unexpected end of stream";
+}
+
+} // namespace framing
+} // namespace nodesnappy
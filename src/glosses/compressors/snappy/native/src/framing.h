@@ -0,0 +1,93 @@
+#ifndef __NODESNAPPY_FRAMING_H_
+#define __NODESNAPPY_FRAMING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "fragment.h"
+
+// Snappy framing format, see snappy/framing_format.txt.
+
+namespace nodesnappy
+{
+namespace framing
+{
+
+// Maximum amount of uncompressed data in a single chunk.
+static const size_t kMaxBlockSize = 65536;
+
+// Size of the stream identifier chunk that starts every stream.
+static const size_t kStreamIdentifierSize = 10;
+
+// Chunk header: type (1 byte) and length (3 bytes, little endian).
+static const size_t kChunkHeaderSize = 4;
+
+// Masked CRC-32C stored in compressed and uncompressed data chunks.
+static const size_t kChecksumSize = 4;
+
+uint32_t MaskedCrc32c(const char *data, size_t length);
+
+// Upper bound of the size of the chunks that FrameCompress() produces for
+// length bytes of input, not including the stream identifier.
+size_t MaxFramedLength(size_t length);
+
+// Writes the stream identifier chunk, returns kStreamIdentifierSize.
+size_t WriteStreamIdentifier(char *dst);
+
+// Splits the input into blocks of at most kMaxBlockSize bytes and writes
+// one chunk per block. Blocks that do not compress are stored as
+// uncompressed chunks. dst must hold MaxFramedLength(length) bytes.
+// Returns the number of bytes written. level is one of the compression
+// levels of fragment.h.
+size_t FrameCompress(const char *data, size_t length, char *dst, int level = kLevelDefault);
+
+// Writes a single chunk for at most kMaxBlockSize bytes of input. dst must
+// hold MaxFramedLength(length) bytes. Returns the number of bytes written.
+size_t FrameCompressBlock(const char *data, size_t length, char *dst, int level = kLevelDefault);
+
+// Data chunk of a framed stream and the offset of its decoded data.
+struct DataChunk
+{
+  const char *chunk;
+  size_t offset;
+};
+
+// Validates the chunk structure of a complete framed stream and collects
+// its data chunks, so they can be decoded independently of each other.
+// Returns an error message, or NULL on success.
+const char *ScanFrames(const char *data, size_t length, std::vector<DataChunk> *chunks, size_t *uncompressedLength);
+
+// Decodes and verifies a data chunk found by ScanFrames(), dst may be NULL
+// for a chunk without data. Returns an error message, or NULL on success.
+const char *DecodeDataChunk(const char *chunk, char *dst);
+
+// Incremental decoder of a framed stream. Input may be split at arbitrary
+// positions; only an incomplete trailing chunk is kept between calls, so
+// memory use is bounded by the size of a single data chunk.
+class FrameDecoder
+{
+public:
+  FrameDecoder();
+
+  // Decodes every chunk that is complete after appending the input. On
+  // success returns NULL and stores the decoded bytes in a malloc'ed block
+  // owned by the caller (*out is NULL when nothing was decoded). On failure
+  // returns an error message and the decoder must not be used any more.
+  const char *Push(const char *data, size_t length, char **out, size_t *outLength);
+
+  // Returns an error message if the stream ended in the middle of a chunk.
+  const char *Finish() const;
+
+private:
+  std::string pending;
+  size_t skipping;
+  bool identified;
+};
+
+} // namespace framing
+} // namespace nodesnappy
+
+#endif // __NODESNAPPY_FRAMING_H_
@@ -0,0 +1,58 @@
+#include "kernels.h"
+
+#include <snappy.h>
+
+namespace nodesnappy
+{
+namespace kernels
+{
+
+namespace
+{
+
+struct Kernels
+{
+  const char *variant;
+  bool (*rawUncompress)(const char *compressed, size_t length, char *uncompressed);
+  bool (*rawUncompressToIOVec)(const char *compressed, size_t length, const IOVec *iov, size_t iovCount);
+  bool (*isValidCompressedBuffer)(const char *compressed, size_t length);
+};
+
+Kernels Select()
+{
+  if (avx2::Supported())
+  {
+    Kernels res = {"avx2", avx2::RawUncompress, avx2::RawUncompressToIOVec, avx2::IsValidCompressedBuffer};
+    return res;
+  }
+
+  Kernels res = {"generic", snappy::RawUncompress, snappy::RawUncompressToIOVec, snappy::IsValidCompressedBuffer};
+  return res;
+}
+
+const Kernels selected = Select();
+
+} // namespace
+
+bool RawUncompress(const char *compressed, size_t length, char *uncompressed)
+{
+  return selected.rawUncompress(compressed, length, uncompressed);
+}
+
+bool RawUncompressToIOVec(const char *compressed, size_t length, const IOVec *iov, size_t iovCount)
+{
+  return selected.rawUncompressToIOVec(compressed, length, iov, iovCount);
+}
+
+bool IsValidCompressedBuffer(const char *compressed, size_t length)
+{
+  return selected.isValidCompressedBuffer(compressed, length);
+}
+
+const char *Variant()
+{
+  return selected.variant;
+}
+
+} // namespace kernels
+} // namespace nodesnappy
@@ -0,0 +1,51 @@
+#ifndef __NODESNAPPY_KERNELS_H_
+#define __NODESNAPPY_KERNELS_H_
+
+#include <stddef.h>
+
+#include <snappy-stubs-public.h>
+
+// Decompression kernels of snappy. snappylib is built for any CPU of the
+// target architecture; kernels_avx2.cc builds the same sources once more for
+// x86 CPUs with AVX2 and BMI2, enabling the pshufb pattern fills and the
+// BMI2 tag decoding. The build to use is chosen once, at load time.
+
+namespace nodesnappy
+{
+namespace kernels
+{
+
+namespace detail
+{
+using namespace snappy;
+typedef iovec IOVec;
+} // namespace detail
+
+// struct iovec of the platform, or the one of snappy where there is none.
+typedef detail::IOVec IOVec;
+
+// Same contracts as the snappy functions of the same names.
+bool RawUncompress(const char *compressed, size_t length, char *uncompressed);
+bool RawUncompressToIOVec(const char *compressed, size_t length, const IOVec *iov, size_t iovCount);
+bool IsValidCompressedBuffer(const char *compressed, size_t length);
+
+// Name of the kernels in use: "avx2" or "generic".
+const char *Variant();
+
+namespace avx2
+{
+
+// Whether the AVX2 build is part of the binary and the CPU supports it.
+bool Supported();
+
+// Only to be called when Supported() returns true.
+bool RawUncompress(const char *compressed, size_t length, char *uncompressed);
+bool RawUncompressToIOVec(const char *compressed, size_t length, const IOVec *iov, size_t iovCount);
+bool IsValidCompressedBuffer(const char *compressed, size_t length);
+
+} // namespace avx2
+
+} // namespace kernels
+} // namespace nodesnappy
+
+#endif // __NODESNAPPY_KERNELS_H_
@@ -0,0 +1,124 @@
+#include "kernels.h"
+
+// snappylib's sources built for CPUs with AVX2 and BMI2, in the namespace
+// snappy_avx2. Requires GCC or Clang on x86; elsewhere the generic kernels
+// are always used.
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && defined(HAVE_CONFIG_H)
+#define NODESNAPPY_AVX2_KERNELS 1
+#else
+#define NODESNAPPY_AVX2_KERNELS 0
+#endif
+
+#if NODESNAPPY_AVX2_KERNELS
+
+// Everything outside of snappy is included before the target region, so
+// inline functions of the standard library are not compiled for AVX2 here
+// and then picked by the linker for the rest of the binary.
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// kernels.h already included the public stubs in namespace snappy; they
+// must be seen once more in namespace snappy_avx2.
+#undef THIRD_PARTY_SNAPPY_OPENSOURCE_SNAPPY_STUBS_PUBLIC_H_
+
+// The configuration of snappylib, then the features of this build.
+#include "config.h"
+#undef SNAPPY_HAVE_SSSE3
+#define SNAPPY_HAVE_SSSE3 1
+#undef SNAPPY_HAVE_BMI2
+#define SNAPPY_HAVE_BMI2 1
+
+#define snappy snappy_avx2
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,bmi2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,bmi2")
+#endif
+
+#include "snappy/snappy.cc"
+#include "snappy/snappy-sinksource.cc"
+#include "snappy/snappy-stubs-internal.cc"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#undef snappy
+
+#endif // NODESNAPPY_AVX2_KERNELS
+
+namespace nodesnappy
+{
+namespace kernels
+{
+namespace avx2
+{
+
+#if NODESNAPPY_AVX2_KERNELS
+
+bool Supported()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2");
+}
+
+bool RawUncompress(const char *compressed, size_t length, char *uncompressed)
+{
+  return snappy_avx2::RawUncompress(compressed, length, uncompressed);
+}
+
+bool RawUncompressToIOVec(const char *compressed, size_t length, const IOVec *iov, size_t iovCount)
+{
+  return snappy_avx2::RawUncompressToIOVec(compressed, length, iov, iovCount);
+}
+
+bool IsValidCompressedBuffer(const char *compressed, size_t length)
+{
+  return snappy_avx2::IsValidCompressedBuffer(compressed, length);
+}
+
+#else
+
+bool Supported()
+{
+  return false;
+}
+
+bool RawUncompress(const char *, size_t, char *)
+{
+  return false;
+}
+
+bool RawUncompressToIOVec(const char *, size_t, const IOVec *, size_t)
+{
+  return false;
+}
+
+bool IsValidCompressedBuffer(const char *, size_t)
+{
+  return false;
+}
+
+#endif // NODESNAPPY_AVX2_KERNELS
+
+} // namespace avx2
+} // namespace kernels
+} // namespace nodesnappy
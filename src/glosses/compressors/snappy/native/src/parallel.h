@@ -0,0 +1,117 @@
+#ifndef __NODESNAPPY_PARALLEL_H_
+#define __NODESNAPPY_PARALLEL_H_
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "executor.h"
+
+namespace nodesnappy
+{
+
+// Number of threads to use when the caller does not ask for a specific one:
+// every thread of the pool.
+inline size_t DefaultConcurrency()
+{
+  return adone::Executor::Default().Stats().threads;
+}
+
+namespace detail
+{
+
+// Indexes of a ParallelFor() shared by the caller and its helpers. It is
+// reference counted, as helpers may only start after the caller returned.
+class ParallelState
+{
+public:
+  ParallelState(size_t count, const std::function<void(size_t)> *fn)
+      : count(count), next(0), done(0), fn(fn) {}
+
+  void Run()
+  {
+    for (size_t i = next++; i < count; i = next++)
+    {
+      (*fn)(i);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (++done == count)
+        finished.notify_all();
+    }
+  }
+
+  // Waits for the indexes taken by other threads.
+  void Wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (done < count)
+      finished.wait(lock);
+  }
+
+private:
+  const size_t count;
+  std::atomic<size_t> next;
+  size_t done;
+  const std::function<void(size_t)> *fn;
+  std::mutex mutex;
+  std::condition_variable finished;
+};
+
+class ParallelJob : public adone::ExecutorJob
+{
+public:
+  explicit ParallelJob(const std::shared_ptr<ParallelState> &state) : state(state) {}
+
+  void Perform()
+  {
+    state->Run();
+    delete this;
+  }
+
+private:
+  std::shared_ptr<ParallelState> state;
+};
+
+} // namespace detail
+
+// Runs fn(0) ... fn(count - 1) on the calling pool thread and on up to
+// `threads - 1` idle threads of the pool, which then use their own working
+// memory (ThreadContext()). Threads take the next index from a shared
+// counter as soon as they are done with the previous one, so uneven work is
+// balanced without any up front partitioning. The caller does whatever no
+// helper took, so it never waits for a helper that did not start.
+template <typename Fn>
+void ParallelFor(size_t count, size_t threads, Fn fn)
+{
+  adone::Executor &executor = adone::Executor::Default();
+  adone::ExecutorStats stats = executor.Stats();
+  size_t idle = stats.threads > stats.running ? stats.threads - stats.running : 0;
+  size_t total = std::min(std::min(threads, count), idle + 1);
+
+  std::function<void(size_t)> body(fn);
+  std::shared_ptr<detail::ParallelState> state = std::make_shared<detail::ParallelState>(count, &body);
+
+  // Idle threads mean empty lanes, the high one gets helpers started even
+  // if a job slipped in meanwhile.
+  for (size_t i = 1; i < total; i++)
+  {
+    detail::ParallelJob *job = new detail::ParallelJob(state);
+    if (!executor.Submit(job, adone::kLaneHigh))
+    {
+      delete job;
+      break;
+    }
+  }
+
+  state->Run();
+  state->Wait();
+}
+
+} // namespace nodesnappy
+
+#endif // __NODESNAPPY_PARALLEL_H_
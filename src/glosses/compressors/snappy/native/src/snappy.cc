@@ -1,274 +1,1567 @@
-#include <adone.h>
-#include <node_buffer.h>
-#include <node_version.h>
+#define NAPI_VERSION 4
+#define NAPI_DISABLE_CPP_EXCEPTIONS
+#include <napi.h>
 #include <snappy.h>
 
-#include <string.h> // memcpy
+#include <stdlib.h> // malloc, free
+#include <string.h> // memmove
 
-#include <string>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <vector>
+
+#include "codec.h"
+#include "decoder.h"
+#include "executor_napi.h"
+#include "framing.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "stats.h"
 
 namespace nodesnappy
 {
 
-class CompressWorker : public Nan::AsyncWorker
+inline Napi::Value ThrowError(Napi::Env env, const char *message)
+{
+  Napi::Error::New(env, message).ThrowAsJavaScriptException();
+  return env.Undefined();
+}
+
+inline Napi::Value ThrowRangeError(Napi::Env env, const char *message)
+{
+  Napi::RangeError::New(env, message).ThrowAsJavaScriptException();
+  return env.Undefined();
+}
+
+inline void FreeOutput(Napi::Env, char *data)
+{
+  free(data);
+}
+
+// Results of workers from this size on become the backing store of their
+// Buffer instead of being copied.
+static const size_t kExternalOutput = 1024 * 1024;
+
+// Hands a malloc'ed output block over to JS and frees it. Buffers get a copy
+// in memory of Node: the finalizer of an external Buffer only runs once the
+// event loop turns, so a loop of sync calls would never give any back, and
+// creating one costs more than copying a small result.
+inline Napi::Value OutputValue(Napi::Env env, char *data, size_t length, bool asBuffer)
+{
+  if (asBuffer)
+  {
+    Napi::Buffer<char> res = Napi::Buffer<char>::Copy(env, data, length);
+    free(data);
+    return res;
+  }
+
+  // ASCII is valid Latin-1, which V8 copies into a one-byte string as is
+  // instead of decoding it.
+  napi_value res;
+  if (IsAscii(data, length))
+    napi_create_string_latin1(env, data, length, &res);
+  else
+    napi_create_string_utf8(env, data, length, &res);
+  free(data);
+  return Napi::Value(env, res);
+}
+
+// Same for the result of a worker, whose caller waits for the event loop
+// anyway: a large Buffer takes the block over instead of copying it.
+inline Napi::Value WorkerOutputValue(Napi::Env env, char *data, size_t length, bool asBuffer)
+{
+  if (asBuffer && length >= kExternalOutput)
+  {
+    return Napi::Buffer<char>::New(env, data, length, FreeOutput);
+  }
+
+  return OutputValue(env, data, length, asBuffer);
+}
+
+// Encodes a string as UTF-8 into a malloc'ed block. Returns NULL if the
+// value is not a string or when out of memory.
+inline char *EncodeUtf8(Napi::Value value, size_t *length)
+{
+  napi_env env = value.Env();
+  size_t chars;
+  if (napi_get_value_string_utf16(env, value, NULL, 0, &chars) != napi_ok)
+    return NULL;
+
+  // Optimistically encode into one byte per character. That holds all of an
+  // ASCII string, so the common case takes a single pass over the string.
+  char *data = static_cast<char *>(malloc(chars + 1));
+  if (data == NULL)
+    return NULL;
+
+  napi_get_value_string_utf8(env, value, data, chars + 1, length);
+  if (*length == chars && IsAscii(data, chars))
+    return data;
+
+  // Anything else was cut short, measure and encode it again.
+  napi_get_value_string_utf8(env, value, NULL, 0, length);
+  char *grown = static_cast<char *>(realloc(data, *length + 1));
+  if (grown == NULL)
+  {
+    free(data);
+    return NULL;
+  }
+
+  napi_get_value_string_utf8(env, value, grown, *length + 1, length);
+  return grown;
+}
+
+// Returns the input as a Buffer. Strings are encoded as UTF-8 and copied
+// into a new Buffer that a worker can pin. Returns an empty value and throws
+// if the input is neither.
+inline Napi::Buffer<char> InputBuffer(Napi::Value value)
+{
+  if (value.IsBuffer())
+  {
+    return value.As<Napi::Buffer<char>>();
+  }
+
+  size_t length;
+  char *data = EncodeUtf8(value, &length);
+  if (data == NULL)
+  {
+    ThrowError(value.Env(), "Input must be a String or a Buffer");
+    return Napi::Buffer<char>();
+  }
+
+  // Copied into memory of Node, see OutputValue().
+  Napi::Buffer<char> res = Napi::Buffer<char>::Copy(value.Env(), data, length);
+  free(data);
+  return res;
+}
+
+// Input bytes of a Buffer, read in place, or of a string, encoded as UTF-8
+// into a block owned by this object.
+class InputData
 {
 public:
-  CompressWorker(std::string *input, Nan::Callback *callback)
-      : Nan::AsyncWorker(callback), input(input) {}
+  explicit InputData(Napi::Value value) : data(NULL), length(0), owned(NULL), valid(false)
+  {
+    if (value.IsBuffer())
+    {
+      // The memory of an empty Buffer may be NULL.
+      Napi::Buffer<char> buffer = value.As<Napi::Buffer<char>>();
+      data = buffer.Data();
+      length = buffer.Length();
+      valid = true;
+    }
+    else
+    {
+      data = owned = EncodeUtf8(value, &length);
+      valid = owned != NULL;
+    }
+  }
 
-  ~CompressWorker()
+  ~InputData()
   {
-    delete input;
+    free(owned);
   }
 
-  void Execute()
+  bool IsValid() const { return valid; }
+
+  const char *data;
+  size_t length;
+
+private:
+  InputData(const InputData &);
+  void operator=(const InputData &);
+
+  char *owned;
+  bool valid;
+};
+
+// Base class for workers that settle a promise with their result instead of
+// calling back into JS, so no callback has to be created per call. They run
+// on the pool of the addon rather than on the libuv one (see executor.h).
+class PromiseWorker : public adone::napi::Worker
+{
+public:
+  PromiseWorker(Napi::Env env, stats::Operation operation, size_t bytesIn)
+      : adone::napi::Worker(env), deferred(Napi::Promise::Deferred::New(env)), operation(operation),
+        bytesIn(bytesIn) {}
+
+  // Queues the worker and returns the promise of its result, or null without
+  // doing anything if the pool is full, in which case JS waits for the pool
+  // to drain and calls again.
+  Napi::Value Run()
+  {
+    Napi::Promise promise = deferred.Promise();
+    if (!Queue(Lane()))
+    {
+      Napi::Env env = Env();
+      delete this;
+      return env.Null();
+    }
+    return promise;
+  }
+
+protected:
+  virtual Napi::Value Result() = 0;
+
+  // Bulk work waits behind single buffers by default.
+  virtual adone::Lane Lane() const
   {
-    snappy::Compress(input->data(), input->length(), &dst);
+    return adone::kLaneLow;
   }
 
-  void HandleOKCallback()
+  // Size of the output and input stored by the adaptive mode, for the
+  // telemetry.
+  virtual size_t BytesOut() const = 0;
+
+  virtual size_t StoredBytes() const
   {
-    Nan::HandleScope scope;
+    return 0;
+  }
 
-    v8::Local<v8::Object> res = Nan::NewBuffer(dst.length()).ToLocalChecked();
-    memcpy(node::Buffer::Data(res), dst.c_str(), dst.length());
+  void OnExecuted(bool failed, uint64_t queueWaitNs, uint64_t executeNs)
+  {
+    stats::Counters delta;
+    delta.value[stats::kCalls] = 1;
+    delta.value[stats::kAsyncCalls] = 1;
+    delta.value[stats::kFailures] = failed ? 1 : 0;
+    delta.value[stats::kBytesIn] = bytesIn;
+    delta.value[stats::kBytesOut] = failed ? 0 : BytesOut();
+    delta.value[stats::kExecuteNs] = executeNs;
+    delta.value[stats::kQueueWaitNs] = queueWaitNs;
+    delta.value[stats::kStoredBytes] = failed ? 0 : StoredBytes();
+    stats::Record(operation, delta);
+  }
 
-    v8::Local<v8::Value> argv[] = {
-        Nan::Null(), res};
+  void OnOK()
+  {
+    deferred.Resolve(Result());
+  }
 
-    callback->Call(2, argv, async_resource);
+  void OnError(const Napi::Error &e)
+  {
+    deferred.Reject(e.Value());
   }
 
+  Napi::Promise::Deferred deferred;
+
 private:
-  std::string *input;
-  std::string dst;
+  stats::Operation operation;
+  size_t bytesIn;
+};
+
+// Returns a promise rejected with the pending exception, so the async
+// methods report argument errors the same way as failures of the work.
+inline Napi::Value Rejected(Napi::Env env)
+{
+  Napi::Error error = env.GetAndClearPendingException();
+  Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+  deferred.Reject(error.Value());
+  return deferred.Promise();
+}
+
+// Base class for workers that read their input straight from the caller's
+// Buffer. The Buffer is pinned with a persistent reference for the lifetime
+// of the worker, so Execute() can use its memory without copying it first.
+class BufferInputWorker : public PromiseWorker
+{
+public:
+  BufferInputWorker(Napi::Buffer<char> input, stats::Operation operation)
+      : PromiseWorker(input.Env(), operation, input.Length()),
+        pinned(Napi::Persistent(static_cast<Napi::Object>(input))),
+        data(input.Data()),
+        length(input.Length()) {}
+
+protected:
+  // Small inputs are latency bound and cheap, so they overtake large ones.
+  adone::Lane Lane() const
+  {
+    return length <= kSmallInput ? adone::kLaneHigh : adone::kLaneNormal;
+  }
+
+  static const size_t kSmallInput = 64 * 1024;
+
+  Napi::ObjectReference pinned;
+  const char *data;
+  size_t length;
 };
 
-class IsValidCompressedWorker : public Nan::AsyncWorker
+// Base class for workers producing a single malloc'ed output block that is
+// handed over to JS on success and freed otherwise.
+class OutputWorker : public BufferInputWorker
 {
 public:
-  IsValidCompressedWorker(std::string *input, Nan::Callback *callback)
-      : Nan::AsyncWorker(callback), input(input) {}
+  OutputWorker(Napi::Buffer<char> input, bool asBuffer, stats::Operation operation)
+      : BufferInputWorker(input, operation), dst(NULL), dstLength(0), asBuffer(asBuffer) {}
+
+  ~OutputWorker()
+  {
+    free(dst);
+  }
+
+protected:
+  Napi::Value Result()
+  {
+    Napi::Value res = WorkerOutputValue(Env(), dst, dstLength, asBuffer);
+    dst = NULL;
+    return res;
+  }
 
-  ~IsValidCompressedWorker()
+  size_t BytesOut() const
   {
-    delete input;
+    return dstLength;
   }
 
+  char *dst;
+  size_t dstLength;
+  bool asBuffer;
+};
+
+class CompressWorker : public OutputWorker
+{
+public:
+  CompressWorker(Napi::Buffer<char> input, int level, bool adaptive)
+      : OutputWorker(input, true, stats::kCompress), level(level), adaptive(adaptive), stored(0) {}
+
   void Execute()
   {
-    res = snappy::IsValidCompressedBuffer(input->data(), input->length());
+    dst = ThreadContext().CompressToHeap(data, length, &dstLength, level, adaptive, &stored);
+    if (dst == NULL)
+      SetError("Out of memory");
   }
 
-  void HandleOKCallback()
+private:
+  size_t StoredBytes() const
   {
-    Nan::HandleScope scope;
+    return stored;
+  }
 
-    v8::Local<v8::Value> argv[] = {
-        Nan::Null(), res ? Nan::True() : Nan::False()};
+  int level;
+  bool adaptive;
+  size_t stored;
+};
+
+class IsValidCompressedWorker : public BufferInputWorker
+{
+public:
+  explicit IsValidCompressedWorker(Napi::Buffer<char> input)
+      : BufferInputWorker(input, stats::kIsValidCompressed), res(false) {}
 
-    callback->Call(2, argv, async_resource);
+  void Execute()
+  {
+    res = kernels::IsValidCompressedBuffer(data, length);
   }
 
 private:
-  std::string *input;
+  Napi::Value Result()
+  {
+    return Napi::Boolean::New(Env(), res);
+  }
+
+  size_t BytesOut() const
+  {
+    return 0;
+  }
+
   bool res;
 };
 
-class UncompressWorker : public Nan::AsyncWorker
+class UncompressWorker : public OutputWorker
+{
+public:
+  UncompressWorker(Napi::Buffer<char> input, bool asBuffer)
+      : OutputWorker(input, asBuffer, stats::kUncompress) {}
+
+  void Execute()
+  {
+    const char *err = UncompressToHeap(data, length, &dst, &dstLength);
+    if (err != NULL)
+      SetError(err);
+  }
+};
+
+// Resolves the writable range of a Buffer starting at offset. Throws a
+// RangeError and returns false when offset is outside of the Buffer.
+inline bool OutputRange(Napi::Value buffer, Napi::Value offsetValue, char **dst, size_t *capacity)
+{
+  Napi::Buffer<char> object = buffer.As<Napi::Buffer<char>>();
+  size_t length = object.Length();
+  double offset = offsetValue.ToNumber().DoubleValue();
+
+  if (!(offset >= 0 && offset <= length))
+  {
+    ThrowRangeError(buffer.Env(), "Offset is out of bounds");
+    return false;
+  }
+
+  *dst = object.Data() + static_cast<size_t>(offset);
+  *capacity = length - static_cast<size_t>(offset);
+  return true;
+}
+
+class CompressIntoWorker : public BufferInputWorker
+{
+public:
+  CompressIntoWorker(Napi::Buffer<char> input, Napi::Object output, char *dst, size_t capacity, int level)
+      : BufferInputWorker(input, stats::kCompress), pinnedOutput(Napi::Persistent(output)), dst(dst), capacity(capacity),
+        written(0), level(level) {}
+
+  void Execute()
+  {
+    if (!ThreadContext().CompressInto(data, length, dst, capacity, &written, level))
+      SetError(kNotEnoughSpace);
+  }
+
+private:
+  Napi::Value Result()
+  {
+    return Napi::Number::New(Env(), static_cast<double>(written));
+  }
+
+  size_t BytesOut() const
+  {
+    return written;
+  }
+
+  void OnError(const Napi::Error &e)
+  {
+    deferred.Reject(Napi::RangeError::New(Env(), e.Message()).Value());
+  }
+
+  Napi::ObjectReference pinnedOutput;
+  char *dst;
+  size_t capacity;
+  size_t written;
+  int level;
+};
+
+class UncompressIntoWorker : public BufferInputWorker
 {
 public:
-  UncompressWorker(std::string *input, bool asBuffer, Nan::Callback *callback)
-      : Nan::AsyncWorker(callback), input(input), asBuffer(asBuffer) {}
+  UncompressIntoWorker(Napi::Buffer<char> input, Napi::Object output, char *dst, size_t dstLength)
+      : BufferInputWorker(input, stats::kUncompress), pinnedOutput(Napi::Persistent(output)), dst(dst),
+        dstLength(dstLength) {}
+
+  void Execute()
+  {
+    if (!kernels::RawUncompress(data, length, dst))
+      SetError("Invalid input");
+  }
+
+private:
+  Napi::Value Result()
+  {
+    return Napi::Number::New(Env(), static_cast<double>(dstLength));
+  }
 
-  ~UncompressWorker()
+  size_t BytesOut() const
   {
-    delete input;
+    return dstLength;
   }
 
+  Napi::ObjectReference pinnedOutput;
+  char *dst;
+  size_t dstLength;
+};
+
+// Uncompresses into the memory of several Buffers, filling one after the
+// other. The array of Buffers is pinned, and with it every Buffer.
+class UncompressToBuffersWorker : public BufferInputWorker
+{
+public:
+  UncompressToBuffersWorker(Napi::Buffer<char> input, Napi::Array outputs,
+                            const std::vector<kernels::IOVec> &iov, size_t dstLength)
+      : BufferInputWorker(input, stats::kUncompress), pinnedOutputs(Napi::Persistent(static_cast<Napi::Object>(outputs))),
+        iov(iov), dstLength(dstLength) {}
+
   void Execute()
   {
-    if (!snappy::Uncompress(input->data(), input->length(), &dst))
-      SetErrorMessage("Invalid input");
+    if (!kernels::RawUncompressToIOVec(data, length, iov.data(), iov.size()))
+      SetError("Invalid input");
+  }
+
+private:
+  Napi::Value Result()
+  {
+    return Napi::Number::New(Env(), static_cast<double>(dstLength));
+  }
+
+  size_t BytesOut() const
+  {
+    return dstLength;
   }
 
-  void HandleOKCallback()
+  Napi::ObjectReference pinnedOutputs;
+  std::vector<kernels::IOVec> iov;
+  size_t dstLength;
+};
+
+// Compresses input into the framing format, running the blocks on threads of
+// the pool (see ParallelFor()). Each block is compressed into its own worst
+// case sized slot, then the slots are compacted in order behind the stream
+// identifier.
+class CompressFramedWorker : public OutputWorker
+{
+public:
+  CompressFramedWorker(Napi::Buffer<char> input, size_t threads, int level)
+      : OutputWorker(input, true, stats::kCompressFramed), threads(threads), level(level) {}
+
+  void Execute()
   {
-    Nan::HandleScope scope;
+    const size_t blocks = (length + framing::kMaxBlockSize - 1) / framing::kMaxBlockSize;
+    const size_t slot = framing::MaxFramedLength(framing::kMaxBlockSize);
 
-    v8::Local<v8::Value> res;
-    if (asBuffer)
+    dst = static_cast<char *>(malloc(framing::kStreamIdentifierSize + blocks * slot));
+    if (dst == NULL)
     {
-      res = Nan::NewBuffer(dst.length()).ToLocalChecked();
-      memcpy(node::Buffer::Data(res.As<v8::Object>()), dst.c_str(), dst.length());
+      SetError("Out of memory");
+      return;
     }
-    else
+
+    std::vector<size_t> sizes(blocks);
+    char *slots = dst + framing::kStreamIdentifierSize;
+    const char *input = data;
+    const size_t inputLength = length;
+    const int blockLevel = level;
+
+    ParallelFor(blocks, threads, [&](size_t i) {
+      size_t offset = i * framing::kMaxBlockSize;
+      sizes[i] = framing::FrameCompressBlock(
+          input + offset, std::min(framing::kMaxBlockSize, inputLength - offset), slots + i * slot, blockLevel);
+    });
+
+    dstLength = framing::WriteStreamIdentifier(dst);
+    for (size_t i = 0; i < blocks; i++)
     {
-      res = Nan::New<v8::String>(dst.c_str(), dst.length()).ToLocalChecked();
+      memmove(dst + dstLength, slots + i * slot, sizes[i]);
+      dstLength += sizes[i];
     }
 
-    v8::Local<v8::Value> argv[] = {
-        Nan::Null(), res};
+    char *trimmed = static_cast<char *>(realloc(dst, dstLength));
+    if (trimmed != NULL)
+      dst = trimmed;
+  }
 
-    callback->Call(2, argv, async_resource);
+protected:
+  adone::Lane Lane() const
+  {
+    return adone::kLaneLow;
   }
 
 private:
-  std::string *input;
-  std::string dst;
-  bool asBuffer;
+  size_t threads;
+  int level;
 };
 
-NAN_METHOD(Compress)
+// Decompresses a complete framed stream. The chunk boundaries are found by
+// walking the chunk headers, then the chunks are decoded on threads of the
+// pool straight to their offsets in the output.
+class UncompressFramedWorker : public OutputWorker
 {
-  std::string *input;
+public:
+  UncompressFramedWorker(Napi::Buffer<char> input, size_t threads)
+      : OutputWorker(input, true, stats::kUncompressFramed), threads(threads) {}
 
-  if (node::Buffer::HasInstance(info[0].As<v8::Object>()))
+  void Execute()
   {
-    v8::Local<v8::Object> object = info[0].As<v8::Object>();
-    size_t length = node::Buffer::Length(object);
-    const char *data = node::Buffer::Data(object);
-    input = new std::string(data, length);
+    std::vector<framing::DataChunk> chunks;
+    const char *err = framing::ScanFrames(data, length, &chunks, &dstLength);
+    if (err != NULL)
+    {
+      SetError(err);
+      return;
+    }
+
+    dst = static_cast<char *>(malloc(dstLength > 0 ? dstLength : 1));
+    if (dst == NULL)
+    {
+      SetError("Out of memory");
+      return;
+    }
+
+    std::atomic<const char *> failure(NULL);
+    char *output = dst;
+
+    ParallelFor(chunks.size(), threads, [&](size_t i) {
+      const char *chunkErr = framing::DecodeDataChunk(chunks[i].chunk, output + chunks[i].offset);
+      if (chunkErr != NULL)
+        failure = chunkErr;
+    });
+
+    if (failure != NULL)
+      SetError(failure.load());
   }
-  else
+
+protected:
+  adone::Lane Lane() const
   {
-    Nan::Utf8String param1(info[0].As<v8::String>());
-    input = new std::string(*param1);
+    return adone::kLaneLow;
   }
 
-  Nan::Callback *callback = new Nan::Callback(
-      v8::Local<v8::Function>::Cast(info[1]));
+private:
+  size_t threads;
+};
+
+inline size_t Concurrency(Napi::Value value)
+{
+  double threads = value.ToNumber().DoubleValue();
+  return threads >= 1 ? static_cast<size_t>(threads) : DefaultConcurrency();
+}
+
+// Compression level, see fragment.h. The JS side validates it, so anything
+// else than a known level simply compresses at the default one.
+inline int LevelOf(Napi::Value value)
+{
+  return value.IsUndefined() ? kLevelDefault : value.ToNumber().Int32Value();
+}
 
-  CompressWorker *worker = new CompressWorker(
-      input, callback);
+typedef Napi::Value (*OutputFunction)(Napi::Env env, char *data, size_t length, bool asBuffer);
 
-  Nan::AsyncQueueWorker(worker);
+// Hands a batch over to JS as [data, offsets], both as Buffers made by
+// output (OutputValue() or WorkerOutputValue()). The offsets Buffer holds
+// doubles in native byte order.
+inline Napi::Array BatchValue(Napi::Env env, BatchOutput *out, size_t count, OutputFunction output = OutputValue)
+{
+  Napi::Array res = Napi::Array::New(env, 2);
+  res.Set(0u, output(env, out->data, out->length, true));
+  res.Set(1u, output(env, reinterpret_cast<char *>(out->offsets), (count + 1) * sizeof(double), true));
+  out->data = NULL;
+  out->offsets = NULL;
+  return res;
+}
 
-  return;
+inline size_t TotalLength(const std::vector<Slice> &inputs)
+{
+  size_t res = 0;
+  for (size_t i = 0; i < inputs.size(); i++)
+    res += inputs[i].length;
+  return res;
 }
 
-NAN_METHOD(CompressSync)
+// Worker running a whole batch, so N messages cost one dispatch to the
+// thread pool and one promise instead of N of each. Every input Buffer is
+// pinned for the lifetime of the worker.
+class BatchWorker : public PromiseWorker
 {
-  std::string input;
-  std::string dst;
+public:
+  BatchWorker(Napi::Array held, const std::vector<Slice> &inputs, stats::Operation operation)
+      : PromiseWorker(held.Env(), operation, TotalLength(inputs)), pinned(Napi::Persistent(static_cast<Napi::Object>(held))), inputs(inputs) {}
 
-  if (node::Buffer::HasInstance(info[0].As<v8::Object>()))
+  void Execute()
   {
-    v8::Local<v8::Object> object = info[0].As<v8::Object>();
-    size_t length = node::Buffer::Length(object);
-    const char *data = node::Buffer::Data(object);
-    input.assign(data, length);
+    const char *err = Process(inputs, &out);
+    if (err != NULL)
+      SetError(err);
   }
-  else
+
+protected:
+  // Runs the batch on the worker thread, returns an error message or NULL.
+  virtual const char *Process(const std::vector<Slice> &inputs, BatchOutput *out) = 0;
+
+private:
+  Napi::Value Result()
   {
-    Nan::Utf8String param1(info[0].As<v8::String>());
-    input.assign(*param1);
+    return BatchValue(Env(), &out, inputs.size(), WorkerOutputValue);
   }
 
-  snappy::Compress(input.data(), input.length(), &dst);
-
-  v8::Local<v8::Object> res = Nan::NewBuffer(dst.length()).ToLocalChecked();
-  memcpy(node::Buffer::Data(res), dst.c_str(), dst.length());
+  size_t BytesOut() const
+  {
+    return out.length;
+  }
 
-  info.GetReturnValue().Set(res);
-}
+  Napi::ObjectReference pinned;
+  std::vector<Slice> inputs;
+  BatchOutput out;
+};
 
-NAN_METHOD(IsValidCompressed)
+class CompressBatchWorker : public BatchWorker
 {
-  v8::Local<v8::Object> object = info[0].As<v8::Object>();
-  size_t length = node::Buffer::Length(object);
-  const char *data = node::Buffer::Data(object);
-  std::string *input = new std::string(data, length);
+public:
+  CompressBatchWorker(Napi::Array held, const std::vector<Slice> &inputs, int level)
+      : BatchWorker(held, inputs, stats::kCompressBatch), level(level) {}
 
-  Nan::Callback *callback = new Nan::Callback(
-      v8::Local<v8::Function>::Cast(info[1]));
+private:
+  const char *Process(const std::vector<Slice> &inputs, BatchOutput *out)
+  {
+    return CompressSlices(inputs, out, level);
+  }
 
-  IsValidCompressedWorker *worker = new IsValidCompressedWorker(
-      input, callback);
+  int level;
+};
 
-  Nan::AsyncQueueWorker(worker);
+class UncompressBatchWorker : public BatchWorker
+{
+public:
+  UncompressBatchWorker(Napi::Array held, const std::vector<Slice> &inputs)
+      : BatchWorker(held, inputs, stats::kUncompressBatch) {}
 
-  return;
-}
+private:
+  const char *Process(const std::vector<Slice> &inputs, BatchOutput *out)
+  {
+    return UncompressSlices(inputs, out);
+  }
+};
 
-NAN_METHOD(IsValidCompressedSync)
+// Collects the memory of the Buffers (or strings) of an array without
+// copying Buffers; strings are encoded into Buffers of their own. All of
+// them are collected into `held`, so a worker can pin them.
+class BatchInputs
 {
+public:
+  BatchInputs(Napi::Array array, bool acceptStrings)
+      : held(Napi::Array::New(array.Env(), array.Length())), valid(true)
+  {
+    uint32_t count = array.Length();
+    inputs.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      Napi::Value value = array.Get(i);
+      Napi::Buffer<char> buffer;
+      if (value.IsBuffer())
+      {
+        buffer = value.As<Napi::Buffer<char>>();
+      }
+      else if (acceptStrings)
+      {
+        buffer = InputBuffer(value);
+      }
+      else
+      {
+        ThrowError(array.Env(), "Input must be a Buffer");
+      }
 
-  v8::Local<v8::Object> object = info[0].As<v8::Object>();
-  size_t length = node::Buffer::Length(object);
-  const char *data = node::Buffer::Data(object);
+      if (buffer.IsEmpty())
+      {
+        valid = false;
+        break;
+      }
+      held.Set(i, buffer);
+      inputs[i].data = buffer.Data();
+      inputs[i].length = buffer.Length();
+    }
+  }
+
+  Napi::Array held;
+  std::vector<Slice> inputs;
+  bool valid;
+};
 
-  bool res = snappy::IsValidCompressedBuffer(data, length);
+Napi::Value Compress(const Napi::CallbackInfo &info)
+{
+  Napi::Buffer<char> input = InputBuffer(info[0]);
+  if (input.IsEmpty())
+  {
+    return Rejected(info.Env());
+  }
 
-  info.GetReturnValue().Set((res ? Nan::True() : Nan::False()));
+  CompressWorker *worker = new CompressWorker(input, LevelOf(info[1]), info[2].ToBoolean().Value());
+  return worker->Run();
 }
 
-NAN_METHOD(Uncompress)
+// Sync compression of info[0] at level info[1], adaptive if info[2] is true,
+// using the given context.
+Napi::Value CompressWith(Context &context, const Napi::CallbackInfo &info)
 {
+  InputData input(info[0]);
+  if (!input.IsValid())
+  {
+    return ThrowError(info.Env(), "Input must be a String or a Buffer");
+  }
 
-  v8::Local<v8::Object> object = info[0].As<v8::Object>();
-  v8::Local<v8::Object> optionsObj = info[1].As<v8::Object>();
-  size_t length = node::Buffer::Length(object);
-  const char *data = node::Buffer::Data(object);
-  std::string *input = new std::string(data, length);
-  bool asBuffer = Nan::To<bool>(
-                      Nan::Get(optionsObj, Nan::New("asBuffer").ToLocalChecked())
-                          .ToLocalChecked())
-                      .FromJust();
-
-  Nan::Callback *callback = new Nan::Callback(
-      v8::Local<v8::Function>::Cast(info[2]));
+  stats::Scope scope(stats::kCompress, input.length);
+  size_t dstLength;
+  size_t stored = 0;
+  const char *dst = context.CompressToScratch(input.data, input.length, &dstLength, LevelOf(info[1]),
+                                              info[2].ToBoolean().Value(), &stored);
+  if (dst == NULL)
+  {
+    return ThrowError(info.Env(), "Out of memory");
+  }
+  scope.Done(dstLength, stored);
 
-  UncompressWorker *worker = new UncompressWorker(
-      input, asBuffer, callback);
+  return Napi::Buffer<char>::Copy(info.Env(), dst, dstLength);
+}
 
-  Nan::AsyncQueueWorker(worker);
+Napi::Value CompressSync(const Napi::CallbackInfo &info)
+{
+  return CompressWith(ThreadContext(), info);
+}
 
-  return;
+Napi::Value IsValidCompressed(const Napi::CallbackInfo &info)
+{
+  IsValidCompressedWorker *worker = new IsValidCompressedWorker(info[0].As<Napi::Buffer<char>>());
+  return worker->Run();
 }
 
-NAN_METHOD(UncompressSync)
+Napi::Value IsValidCompressedSync(const Napi::CallbackInfo &info)
 {
-  std::string dst;
+  Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
 
-  v8::Local<v8::Object> object = info[0].As<v8::Object>();
-  size_t length = node::Buffer::Length(object);
-  const char *data = node::Buffer::Data(object);
+  stats::Scope scope(stats::kIsValidCompressed, input.Length());
+  bool res = kernels::IsValidCompressedBuffer(input.Data(), input.Length());
+  scope.Done(0);
 
-  v8::Local<v8::Object> optionsObj = info[1].As<v8::Object>();
-  bool asBuffer = Nan::To<bool>(
-                      Nan::Get(optionsObj, Nan::New("asBuffer").ToLocalChecked())
-                          .ToLocalChecked())
-                      .FromJust();
+  return Napi::Boolean::New(info.Env(), res);
+}
 
-  if (!snappy::Uncompress(data, length, &dst))
-  {
-    return Nan::ThrowError("Invalid input");
-  }
+// Reads the length header in place, without validating the rest.
+Napi::Value GetUncompressedLength(const Napi::CallbackInfo &info)
+{
+  Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
 
-  v8::Local<v8::Value> res;
-  if (asBuffer)
-  {
-    res = Nan::NewBuffer(dst.length()).ToLocalChecked();
-    memcpy(node::Buffer::Data(res.As<v8::Object>()), dst.c_str(), dst.length());
-  }
-  else
+  size_t length;
+  if (!snappy::GetUncompressedLength(input.Data(), input.Length(), &length))
   {
-    res = Nan::New<v8::String>(dst.c_str(), dst.length()).ToLocalChecked();
+    return ThrowError(info.Env(), "Invalid input");
   }
 
-  info.GetReturnValue().Set(res);
+  return Napi::Number::New(info.Env(), static_cast<double>(length));
 }
 
-extern "C" NAN_MODULE_INIT(init)
+inline bool AsBuffer(Napi::Value options)
 {
-  Nan::SetMethod(target, "compress", Compress);
-  Nan::SetMethod(target, "compressSync", CompressSync);
-  Nan::SetMethod(target, "isValidCompressed", IsValidCompressed);
-  Nan::SetMethod(target, "isValidCompressedSync", IsValidCompressedSync);
-  Nan::SetMethod(target, "uncompress", Uncompress);
-  Nan::SetMethod(target, "uncompressSync", UncompressSync);
+  return options.As<Napi::Object>().Get("asBuffer").ToBoolean().Value();
+}
+
+// Largest output allowed by a maxOutput value, unlimited when undefined.
+inline size_t MaxOutput(Napi::Value value)
+{
+  if (value.IsUndefined())
+    return std::numeric_limits<size_t>::max();
+
+  double max = value.ToNumber().DoubleValue();
+  if (!(max >= 0))
+    return 0;
+  return max < static_cast<double>(std::numeric_limits<size_t>::max())
+             ? static_cast<size_t>(max)
+             : std::numeric_limits<size_t>::max();
+}
+
+// Throws a RangeError if the length header of the input exceeds maxOutput,
+// before anything is allocated. Invalid headers are left to decompression.
+// Returns false if an error was thrown.
+inline bool CheckMaxOutput(Napi::Buffer<char> input, Napi::Value options)
+{
+  size_t maxOutput = MaxOutput(options.As<Napi::Object>().Get("maxOutput"));
+  size_t length;
+  if (snappy::GetUncompressedLength(input.Data(), input.Length(), &length) && length > maxOutput)
+  {
+    ThrowRangeError(input.Env(), kOutputTooLarge);
+    return false;
+  }
+
+  return true;
+}
+
+Napi::Value Uncompress(const Napi::CallbackInfo &info)
+{
+  Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
+  if (!CheckMaxOutput(input, info[1]))
+  {
+    return Rejected(info.Env());
+  }
+
+  UncompressWorker *worker = new UncompressWorker(input, AsBuffer(info[1]));
+  return worker->Run();
+}
+
+Napi::Value UncompressSync(const Napi::CallbackInfo &info)
+{
+  Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
+  if (!CheckMaxOutput(input, info[1]))
+  {
+    return info.Env().Undefined();
+  }
+
+  stats::Scope scope(stats::kUncompress, input.Length());
+  if (AsBuffer(info[1]))
+  {
+    // The header gives the exact size, so a Buffer is filled in place.
+    size_t dstLength;
+    if (!snappy::GetUncompressedLength(input.Data(), input.Length(), &dstLength))
+    {
+      return ThrowError(info.Env(), "Invalid input");
+    }
+
+    Napi::Buffer<char> res = Napi::Buffer<char>::New(info.Env(), dstLength);
+    if (!kernels::RawUncompress(input.Data(), input.Length(), res.Data()))
+    {
+      return ThrowError(info.Env(), "Invalid input");
+    }
+    scope.Done(dstLength);
+
+    return res;
+  }
+
+  char *dst;
+  size_t dstLength;
+  const char *err = UncompressToHeap(input.Data(), input.Length(), &dst, &dstLength);
+  if (err != NULL)
+  {
+    return ThrowError(info.Env(), err);
+  }
+  scope.Done(dstLength);
+
+  return OutputValue(info.Env(), dst, dstLength, false);
+}
+
+Napi::Value CompressIntoMethod(const Napi::CallbackInfo &info)
+{
+  char *dst;
+  size_t capacity;
+  if (!OutputRange(info[1], info[2], &dst, &capacity))
+  {
+    return Rejected(info.Env());
+  }
+
+  Napi::Buffer<char> input = InputBuffer(info[0]);
+  if (input.IsEmpty())
+  {
+    return Rejected(info.Env());
+  }
+
+  CompressIntoWorker *worker = new CompressIntoWorker(
+      input, info[1].As<Napi::Object>(), dst, capacity, LevelOf(info[3]));
+  return worker->Run();
+}
+
+// Sync compression of info[0] into info[1] at offset info[2], at level
+// info[3], using the given context.
+Napi::Value CompressIntoWith(Context &context, const Napi::CallbackInfo &info)
+{
+  char *dst;
+  size_t capacity;
+  if (!OutputRange(info[1], info[2], &dst, &capacity))
+  {
+    return info.Env().Undefined();
+  }
+
+  InputData input(info[0]);
+  if (!input.IsValid())
+  {
+    return ThrowError(info.Env(), "Input must be a String or a Buffer");
+  }
+
+  stats::Scope scope(stats::kCompress, input.length);
+  size_t written;
+  if (!context.CompressInto(input.data, input.length, dst, capacity, &written, LevelOf(info[3])))
+  {
+    return ThrowRangeError(info.Env(), kNotEnoughSpace);
+  }
+  scope.Done(written);
+
+  return Napi::Number::New(info.Env(), static_cast<double>(written));
+}
+
+Napi::Value CompressIntoSync(const Napi::CallbackInfo &info)
+{
+  return CompressIntoWith(ThreadContext(), info);
+}
+
+// Validates the header of the compressed input against the output range,
+// throwing the appropriate error. Returns false if an error was thrown.
+inline bool CheckUncompressInto(Napi::Buffer<char> input, size_t capacity, size_t *dstLength)
+{
+  if (!snappy::GetUncompressedLength(input.Data(), input.Length(), dstLength))
+  {
+    ThrowError(input.Env(), "Invalid input");
+    return false;
+  }
+
+  if (*dstLength > capacity)
+  {
+    ThrowRangeError(input.Env(), kNotEnoughSpace);
+    return false;
+  }
+
+  return true;
+}
+
+Napi::Value UncompressInto(const Napi::CallbackInfo &info)
+{
+  char *dst;
+  size_t capacity;
+  size_t dstLength;
+  Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
+  if (!OutputRange(info[1], info[2], &dst, &capacity) || !CheckUncompressInto(input, capacity, &dstLength))
+  {
+    return Rejected(info.Env());
+  }
+
+  UncompressIntoWorker *worker = new UncompressIntoWorker(input, info[1].As<Napi::Object>(), dst, dstLength);
+  return worker->Run();
+}
+
+Napi::Value UncompressIntoSync(const Napi::CallbackInfo &info)
+{
+  char *dst;
+  size_t capacity;
+  size_t dstLength;
+  Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
+  if (!OutputRange(info[1], info[2], &dst, &capacity) || !CheckUncompressInto(input, capacity, &dstLength))
+  {
+    return info.Env().Undefined();
+  }
+
+  stats::Scope scope(stats::kUncompress, input.Length());
+  if (!kernels::RawUncompress(input.Data(), input.Length(), dst))
+  {
+    return ThrowError(info.Env(), "Invalid input");
+  }
+  scope.Done(dstLength);
+
+  return Napi::Number::New(info.Env(), static_cast<double>(dstLength));
+}
+
+// Collects the memory of an array of Buffers. Throws and returns false if
+// an element is not a Buffer.
+inline bool OutputVectors(Napi::Array outputs, std::vector<kernels::IOVec> *iov, size_t *capacity)
+{
+  uint32_t count = outputs.Length();
+  iov->resize(count);
+  *capacity = 0;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    Napi::Value value = outputs.Get(i);
+    if (!value.IsBuffer())
+    {
+      ThrowError(outputs.Env(), "Output must be a Buffer");
+      return false;
+    }
+
+    Napi::Buffer<char> buffer = value.As<Napi::Buffer<char>>();
+    (*iov)[i].iov_base = buffer.Data();
+    (*iov)[i].iov_len = buffer.Length();
+    *capacity += buffer.Length();
+  }
+
+  return true;
+}
+
+Napi::Value UncompressToBuffers(const Napi::CallbackInfo &info)
+{
+  std::vector<kernels::IOVec> iov;
+  size_t capacity;
+  size_t dstLength;
+  Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
+  Napi::Array outputs = info[1].As<Napi::Array>();
+  if (!OutputVectors(outputs, &iov, &capacity) || !CheckUncompressInto(input, capacity, &dstLength))
+  {
+    return Rejected(info.Env());
+  }
+
+  UncompressToBuffersWorker *worker = new UncompressToBuffersWorker(input, outputs, iov, dstLength);
+  return worker->Run();
+}
+
+Napi::Value UncompressToBuffersSync(const Napi::CallbackInfo &info)
+{
+  std::vector<kernels::IOVec> iov;
+  size_t capacity;
+  size_t dstLength;
+  Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
+  if (!OutputVectors(info[1].As<Napi::Array>(), &iov, &capacity) || !CheckUncompressInto(input, capacity, &dstLength))
+  {
+    return info.Env().Undefined();
+  }
+
+  stats::Scope scope(stats::kUncompress, input.Length());
+  if (!kernels::RawUncompressToIOVec(input.Data(), input.Length(), iov.data(), iov.size()))
+  {
+    return ThrowError(info.Env(), "Invalid input");
+  }
+  scope.Done(dstLength);
+
+  return Napi::Number::New(info.Env(), static_cast<double>(dstLength));
+}
+
+Napi::Value CompressFramed(const Napi::CallbackInfo &info)
+{
+  Napi::Buffer<char> input = InputBuffer(info[0]);
+  if (input.IsEmpty())
+  {
+    return Rejected(info.Env());
+  }
+
+  CompressFramedWorker *worker = new CompressFramedWorker(input, Concurrency(info[1]), LevelOf(info[2]));
+  return worker->Run();
+}
+
+Napi::Value UncompressFramed(const Napi::CallbackInfo &info)
+{
+  UncompressFramedWorker *worker = new UncompressFramedWorker(
+      info[0].As<Napi::Buffer<char>>(), Concurrency(info[1]));
+  return worker->Run();
+}
+
+Napi::Value CompressBatch(const Napi::CallbackInfo &info)
+{
+  BatchInputs batch(info[0].As<Napi::Array>(), true);
+  if (!batch.valid)
+  {
+    return Rejected(info.Env());
+  }
+
+  BatchWorker *worker = new CompressBatchWorker(batch.held, batch.inputs, LevelOf(info[1]));
+  return worker->Run();
+}
+
+Napi::Value CompressBatchSync(const Napi::CallbackInfo &info)
+{
+  BatchInputs batch(info[0].As<Napi::Array>(), true);
+  if (!batch.valid)
+  {
+    return info.Env().Undefined();
+  }
+
+  stats::Scope scope(stats::kCompressBatch, TotalLength(batch.inputs));
+  BatchOutput out;
+  const char *err = CompressSlices(batch.inputs, &out, LevelOf(info[1]));
+  if (err != NULL)
+  {
+    return ThrowError(info.Env(), err);
+  }
+  scope.Done(out.length);
+
+  return BatchValue(info.Env(), &out, batch.inputs.size());
+}
+
+Napi::Value UncompressBatch(const Napi::CallbackInfo &info)
+{
+  BatchInputs batch(info[0].As<Napi::Array>(), false);
+  if (!batch.valid)
+  {
+    return Rejected(info.Env());
+  }
+
+  BatchWorker *worker = new UncompressBatchWorker(batch.held, batch.inputs);
+  return worker->Run();
+}
+
+Napi::Value UncompressBatchSync(const Napi::CallbackInfo &info)
+{
+  BatchInputs batch(info[0].As<Napi::Array>(), false);
+  if (!batch.valid)
+  {
+    return info.Env().Undefined();
+  }
+
+  stats::Scope scope(stats::kUncompressBatch, TotalLength(batch.inputs));
+  BatchOutput out;
+  const char *err = UncompressSlices(batch.inputs, &out);
+  if (err != NULL)
+  {
+    return ThrowError(info.Env(), err);
+  }
+  scope.Done(out.length);
+
+  return BatchValue(info.Env(), &out, batch.inputs.size());
+}
+
+// Telemetry of the process, see stats.h: an object per operation with the
+// counters as numbers. info[0] resets them once read.
+Napi::Value Stats(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  stats::Counters totals[stats::kOperationCount];
+  stats::Read(totals, info[0].ToBoolean().Value());
+
+  Napi::Object res = Napi::Object::New(env);
+  for (int op = 0; op < stats::kOperationCount; op++)
+  {
+    Napi::Object counters = Napi::Object::New(env);
+    for (int field = 0; field < stats::kFieldCount; field++)
+    {
+      counters.Set(stats::FieldName(static_cast<stats::Field>(field)),
+                   Napi::Number::New(env, static_cast<double>(totals[op].value[field])));
+    }
+    res.Set(stats::OperationName(static_cast<stats::Operation>(op)), counters);
+  }
+
+  return res;
+}
+
+// Compression context owned by JS, so sync calls made through it reuse the
+// same memory no matter which thread context they would get otherwise.
+class SnappyContext : public Napi::ObjectWrap<SnappyContext>
+{
+public:
+  static void Init(Napi::Env env, Napi::Object exports)
+  {
+    Napi::Function ctor = DefineClass(env, "Context", {
+      InstanceMethod("compressSync", &SnappyContext::CompressSync),
+      InstanceMethod("compressIntoSync", &SnappyContext::CompressIntoSync)
+    });
+
+    exports.Set("Context", ctor);
+  }
+
+  SnappyContext(const Napi::CallbackInfo &info)
+      : Napi::ObjectWrap<SnappyContext>(info) {}
+
+private:
+  Napi::Value CompressSync(const Napi::CallbackInfo &info)
+  {
+    return CompressWith(context, info);
+  }
+
+  Napi::Value CompressIntoSync(const Napi::CallbackInfo &info)
+  {
+    return CompressIntoWith(context, info);
+  }
+
+  Context context;
+};
+
+// Runs write() of a framing codec on the pool, for the Transform streams.
+// A stream has at most one write in flight, so the state of the codec is
+// never used by two threads at once. The codec object is pinned until the
+// worker is done.
+template <typename Codec>
+class FramingWriteWorker : public BufferInputWorker
+{
+public:
+  FramingWriteWorker(Codec *codec, Napi::Buffer<char> input, stats::Operation operation)
+      : BufferInputWorker(input, operation), codec(codec), pinnedCodec(Napi::Persistent(codec->Value())),
+        dst(NULL), dstLength(0) {}
+
+  ~FramingWriteWorker()
+  {
+    free(dst);
+  }
+
+  void Execute()
+  {
+    const char *err = codec->Process(data, length, &dst, &dstLength);
+    if (err != NULL)
+      SetError(err);
+  }
+
+private:
+  Napi::Value Result()
+  {
+    if (dst == NULL)
+      return Env().Undefined();
+
+    Napi::Value res = WorkerOutputValue(Env(), dst, dstLength, true);
+    dst = NULL;
+    return res;
+  }
+
+  size_t BytesOut() const
+  {
+    return dstLength;
+  }
+
+  Codec *codec;
+  Napi::ObjectReference pinnedCodec;
+  char *dst;
+  size_t dstLength;
+};
+
+// Encoder of the snappy framing format. Every write() returns the chunks for
+// the given data right away, so nothing is buffered between calls;
+// writeAsync() does the same on the pool and returns a promise, or null if
+// the pool is full. The constructor takes the compression level.
+class FrameEncoder : public Napi::ObjectWrap<FrameEncoder>
+{
+public:
+  static void Init(Napi::Env env, Napi::Object exports)
+  {
+    Napi::Function ctor = DefineClass(env, "FrameEncoder", {
+      InstanceMethod("write", &FrameEncoder::Write),
+      InstanceMethod("writeAsync", &FrameEncoder::WriteAsync),
+      InstanceMethod("end", &FrameEncoder::End)
+    });
+
+    exports.Set("FrameEncoder", ctor);
+  }
+
+  FrameEncoder(const Napi::CallbackInfo &info)
+      : Napi::ObjectWrap<FrameEncoder>(info), started(false), level(LevelOf(info[0])) {}
+
+  // Frames the data, *dst is NULL when there is nothing to write.
+  const char *Process(const char *data, size_t length, char **dst, size_t *dstLength)
+  {
+    *dst = NULL;
+    *dstLength = 0;
+    if (length == 0 && started)
+      return NULL;
+
+    *dst = Encode(data, length, dstLength);
+    return *dst != NULL ? NULL : "Out of memory";
+  }
+
+private:
+  // Frames the data, prefixed by the stream identifier on the first call.
+  // Returns NULL when out of memory.
+  char *Encode(const char *data, size_t length, size_t *dstLength)
+  {
+    size_t header = started ? 0 : framing::kStreamIdentifierSize;
+    char *dst = static_cast<char *>(malloc(header + framing::MaxFramedLength(length)));
+    if (dst == NULL)
+      return NULL;
+
+    if (!started)
+      framing::WriteStreamIdentifier(dst);
+    started = true;
+
+    *dstLength = header + framing::FrameCompress(data, length, dst + header, level);
+
+    char *trimmed = static_cast<char *>(realloc(dst, *dstLength));
+    return trimmed != NULL ? trimmed : dst;
+  }
+
+  Napi::Value Write(const Napi::CallbackInfo &info)
+  {
+    Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
+
+    if (input.Length() == 0 && started)
+    {
+      return info.Env().Undefined();
+    }
+
+    stats::Scope scope(stats::kCompressStream, input.Length());
+    char *dst;
+    size_t dstLength;
+    const char *err = Process(input.Data(), input.Length(), &dst, &dstLength);
+    if (err != NULL)
+    {
+      return ThrowError(info.Env(), err);
+    }
+    scope.Done(dstLength);
+
+    return OutputValue(info.Env(), dst, dstLength, true);
+  }
+
+  Napi::Value WriteAsync(const Napi::CallbackInfo &info)
+  {
+    Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
+    return (new FramingWriteWorker<FrameEncoder>(this, input, stats::kCompressStream))->Run();
+  }
+
+  // An empty stream still consists of the stream identifier.
+  Napi::Value End(const Napi::CallbackInfo &info)
+  {
+    if (started)
+    {
+      return info.Env().Undefined();
+    }
+
+    size_t dstLength;
+    char *dst = Encode(NULL, 0, &dstLength);
+    if (dst == NULL)
+    {
+      return ThrowError(info.Env(), "Out of memory");
+    }
+
+    return OutputValue(info.Env(), dst, dstLength, true);
+  }
+
+  bool started;
+  int level;
+};
+
+// Decoder of the snappy framing format. write() accepts arbitrary slices of
+// the stream and returns everything that could be decoded so far;
+// writeAsync() is its pooled variant, see FrameEncoder.
+class FrameDecoder : public Napi::ObjectWrap<FrameDecoder>
+{
+public:
+  static void Init(Napi::Env env, Napi::Object exports)
+  {
+    Napi::Function ctor = DefineClass(env, "FrameDecoder", {
+      InstanceMethod("write", &FrameDecoder::Write),
+      InstanceMethod("writeAsync", &FrameDecoder::WriteAsync),
+      InstanceMethod("end", &FrameDecoder::End)
+    });
+
+    exports.Set("FrameDecoder", ctor);
+  }
+
+  FrameDecoder(const Napi::CallbackInfo &info)
+      : Napi::ObjectWrap<FrameDecoder>(info) {}
+
+  const char *Process(const char *data, size_t length, char **dst, size_t *dstLength)
+  {
+    return decoder.Push(data, length, dst, dstLength);
+  }
+
+private:
+  Napi::Value Write(const Napi::CallbackInfo &info)
+  {
+    Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
+
+    stats::Scope scope(stats::kUncompressStream, input.Length());
+    char *dst;
+    size_t dstLength;
+    const char *err = Process(input.Data(), input.Length(), &dst, &dstLength);
+    if (err != NULL)
+    {
+      return ThrowError(info.Env(), err);
+    }
+    scope.Done(dst != NULL ? dstLength : 0);
+
+    if (dst == NULL)
+    {
+      return info.Env().Undefined();
+    }
+
+    return OutputValue(info.Env(), dst, dstLength, true);
+  }
+
+  Napi::Value WriteAsync(const Napi::CallbackInfo &info)
+  {
+    Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
+    return (new FramingWriteWorker<FrameDecoder>(this, input, stats::kUncompressStream))->Run();
+  }
+
+  Napi::Value End(const Napi::CallbackInfo &info)
+  {
+    const char *err = decoder.Finish();
+    if (err != NULL)
+    {
+      return ThrowError(info.Env(), err);
+    }
+
+    return info.Env().Undefined();
+  }
+
+  framing::FrameDecoder decoder;
+};
+
+// Incremental decoder of a single compressed block, see decoder.h. push()
+// returns how many bytes of output() are final; the output Buffer exists
+// from the moment the length header has been read. The decoder writes to
+// the memory of that Buffer, which is held by a property of this object
+// rather than by a reference: wrapped objects are finalized once the event
+// loop turns, which would keep the output of a sync loop alive until then.
+class StreamDecoder : public Napi::ObjectWrap<StreamDecoder>, private OutputAllocator
+{
+public:
+  static void Init(Napi::Env env, Napi::Object exports)
+  {
+    Napi::Function ctor = DefineClass(env, "Decoder", {
+      InstanceMethod("push", &StreamDecoder::Push),
+      InstanceMethod("output", &StreamDecoder::Output),
+      InstanceMethod("end", &StreamDecoder::End)
+    });
+
+    exports.Set("Decoder", ctor);
+  }
+
+  // Takes the maxOutput limit of the block.
+  StreamDecoder(const Napi::CallbackInfo &info)
+      : Napi::ObjectWrap<StreamDecoder>(info), decoder(MaxOutput(info[0]), this), hasOutput(false) {}
+
+private:
+  // Called by push() once the length header is complete.
+  char *Allocate(size_t length)
+  {
+    Napi::Buffer<char> buffer = Napi::Buffer<char>::New(Env(), length);
+    if (buffer.IsEmpty())
+      return NULL;
+
+    SetOutput(buffer);
+    return buffer.Data();
+  }
+
+  void SetOutput(Napi::Buffer<char> buffer)
+  {
+    Value().DefineProperty(Napi::PropertyDescriptor::Value(kOutputProperty, buffer, napi_default));
+    hasOutput = true;
+  }
+
+  Napi::Value Push(const Napi::CallbackInfo &info)
+  {
+    Napi::Buffer<char> input = info[0].As<Napi::Buffer<char>>();
+
+    stats::Scope scope(stats::kUncompressStream, input.Length());
+    size_t produced = decoder.Produced();
+    const char *err = decoder.Push(input.Data(), input.Length());
+    if (err == kOutputTooLarge)
+    {
+      return ThrowRangeError(info.Env(), err);
+    }
+    if (err != NULL)
+    {
+      return ThrowError(info.Env(), err);
+    }
+    scope.Done(decoder.Produced() - produced);
+
+    // Nothing is allocated for an empty output.
+    if (decoder.HasLength() && !hasOutput)
+    {
+      SetOutput(Napi::Buffer<char>::New(info.Env(), 0));
+    }
+
+    return Napi::Number::New(info.Env(), static_cast<double>(decoder.Produced()));
+  }
+
+  Napi::Value Output(const Napi::CallbackInfo &info)
+  {
+    return hasOutput ? Value().Get(kOutputProperty) : info.Env().Undefined();
+  }
+
+  Napi::Value End(const Napi::CallbackInfo &info)
+  {
+    const char *err = decoder.Finish();
+    if (err == kOutputTooLarge)
+    {
+      return ThrowRangeError(info.Env(), err);
+    }
+    if (err != NULL)
+    {
+      return ThrowError(info.Env(), err);
+    }
+
+    return info.Env().Undefined();
+  }
+
+  static const char *const kOutputProperty;
+
+  Decoder decoder;
+  bool hasOutput;
+};
+
+const char *const StreamDecoder::kOutputProperty = "_output";
+
+Napi::Object Init(Napi::Env env, Napi::Object exports)
+{
+  exports.Set("compress", Napi::Function::New(env, Compress));
+  exports.Set("compressSync", Napi::Function::New(env, CompressSync));
+  exports.Set("isValidCompressed", Napi::Function::New(env, IsValidCompressed));
+  exports.Set("isValidCompressedSync", Napi::Function::New(env, IsValidCompressedSync));
+  exports.Set("getUncompressedLength", Napi::Function::New(env, GetUncompressedLength));
+  exports.Set("uncompress", Napi::Function::New(env, Uncompress));
+  exports.Set("uncompressSync", Napi::Function::New(env, UncompressSync));
+  exports.Set("compressInto", Napi::Function::New(env, CompressIntoMethod));
+  exports.Set("compressIntoSync", Napi::Function::New(env, CompressIntoSync));
+  exports.Set("uncompressInto", Napi::Function::New(env, UncompressInto));
+  exports.Set("uncompressIntoSync", Napi::Function::New(env, UncompressIntoSync));
+  exports.Set("uncompressToBuffers", Napi::Function::New(env, UncompressToBuffers));
+  exports.Set("uncompressToBuffersSync", Napi::Function::New(env, UncompressToBuffersSync));
+  exports.Set("compressFramed", Napi::Function::New(env, CompressFramed));
+  exports.Set("uncompressFramed", Napi::Function::New(env, UncompressFramed));
+  exports.Set("compressBatch", Napi::Function::New(env, CompressBatch));
+  exports.Set("compressBatchSync", Napi::Function::New(env, CompressBatchSync));
+  exports.Set("uncompressBatch", Napi::Function::New(env, UncompressBatch));
+  exports.Set("uncompressBatchSync", Napi::Function::New(env, UncompressBatchSync));
+  exports.Set("stats", Napi::Function::New(env, Stats));
+
+  exports.Set("kernels", Napi::String::New(env, kernels::Variant()));
+
+  adone::napi::Dispatcher::Setup(env);
+  adone::napi::ExportExecutor(env, exports);
+
+  SnappyContext::Init(env, exports);
+  FrameEncoder::Init(env, exports);
+  FrameDecoder::Init(env, exports);
+  StreamDecoder::Init(env, exports);
+
+  return exports;
 }
 
-NODE_MODULE(binding, init)
+NODE_API_MODULE(snappy, Init)
 } // namespace nodesnappy
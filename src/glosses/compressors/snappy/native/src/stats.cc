@@ -0,0 +1,98 @@
+#include "stats.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace nodesnappy
+{
+namespace stats
+{
+
+namespace
+{
+
+const size_t kShards = 16;
+
+// Aligned so that threads on different shards do not share cache lines.
+struct alignas(64) Shard
+{
+  std::atomic<uint64_t> values[kOperationCount][kFieldCount];
+};
+
+Shard shards[kShards];
+
+// Totals at the last reset, only touched by Read().
+std::mutex baselineMutex;
+Counters baseline[kOperationCount];
+
+std::atomic<size_t> nextShard(0);
+
+Shard &ThreadShard()
+{
+  static thread_local Shard *shard = &shards[nextShard++ % kShards];
+  return *shard;
+}
+
+const char *const kNames[kOperationCount] = {
+    "compress",
+    "uncompress",
+    "isValidCompressed",
+    "compressFramed",
+    "uncompressFramed",
+    "compressBatch",
+    "uncompressBatch",
+    "compressStream",
+    "uncompressStream"};
+
+const char *const kFieldNames[kFieldCount] = {
+    "calls",
+    "asyncCalls",
+    "failures",
+    "bytesIn",
+    "bytesOut",
+    "executeNs",
+    "queueWaitNs",
+    "storedBytes"};
+
+} // namespace
+
+const char *OperationName(Operation operation)
+{
+  return kNames[operation];
+}
+
+const char *FieldName(Field field)
+{
+  return kFieldNames[field];
+}
+
+void Record(Operation operation, const Counters &delta)
+{
+  std::atomic<uint64_t> *values = ThreadShard().values[operation];
+  for (size_t i = 0; i < kFieldCount; i++)
+  {
+    if (delta.value[i] != 0)
+      values[i].fetch_add(delta.value[i], std::memory_order_relaxed);
+  }
+}
+
+void Read(Counters (&totals)[kOperationCount], bool reset)
+{
+  std::lock_guard<std::mutex> lock(baselineMutex);
+  for (size_t op = 0; op < kOperationCount; op++)
+  {
+    for (size_t i = 0; i < kFieldCount; i++)
+    {
+      uint64_t sum = 0;
+      for (size_t s = 0; s < kShards; s++)
+        sum += shards[s].values[op][i].load(std::memory_order_relaxed);
+
+      totals[op].value[i] = sum - baseline[op].value[i];
+      if (reset)
+        baseline[op].value[i] = sum;
+    }
+  }
+}
+
+} // namespace stats
+} // namespace nodesnappy
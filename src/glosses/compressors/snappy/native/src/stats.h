@@ -0,0 +1,116 @@
+#ifndef __NODESNAPPY_STATS_H_
+#define __NODESNAPPY_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+
+// Process wide counters of the work done by the binding, always on. Every
+// thread adds to a shard of its own with relaxed atomics, so recording a
+// call costs a few uncontended increments; Read() sums up the shards.
+
+namespace nodesnappy
+{
+namespace stats
+{
+
+enum Operation
+{
+  kCompress = 0,        // compress, compressInto and Context
+  kUncompress,          // uncompress, uncompressInto and uncompressToBuffers
+  kIsValidCompressed,
+  kCompressFramed,
+  kUncompressFramed,
+  kCompressBatch,
+  kUncompressBatch,
+  kCompressStream,      // chunks of FrameEncoder
+  kUncompressStream,    // chunks of FrameDecoder and Decoder
+  kOperationCount
+};
+
+// Name of the operation as seen from JS.
+const char *OperationName(Operation operation);
+
+enum Field
+{
+  kCalls = 0,
+  kAsyncCalls,
+  kFailures,
+  kBytesIn,
+  kBytesOut,
+  kExecuteNs,    // time spent doing the work
+  kQueueWaitNs,  // time async calls waited for a pool thread
+  kStoredBytes,  // input that the adaptive mode stored uncompressed
+  kFieldCount
+};
+
+const char *FieldName(Field field);
+
+struct Counters
+{
+  Counters() : value() {}
+
+  uint64_t value[kFieldCount];
+};
+
+void Record(Operation operation, const Counters &delta);
+
+// Totals since the start of the process or the last reset. With reset, the
+// totals returned are also the new zero.
+void Read(Counters (&totals)[kOperationCount], bool reset);
+
+inline uint64_t NowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Records a sync call: counts as failed unless Done() is called before the
+// scope ends.
+class Scope
+{
+public:
+  Scope(Operation operation, size_t bytesIn)
+      : operation(operation), bytesIn(bytesIn), storedBytes(0), start(NowNs()), done(false) {}
+
+  ~Scope()
+  {
+    if (!done)
+      Finish(true, 0);
+  }
+
+  void Done(size_t bytesOut, size_t storedBytes = 0)
+  {
+    this->storedBytes = storedBytes;
+    done = true;
+    Finish(false, bytesOut);
+  }
+
+private:
+  Scope(const Scope &);
+  void operator=(const Scope &);
+
+  void Finish(bool failed, size_t bytesOut)
+  {
+    Counters delta;
+    delta.value[kCalls] = 1;
+    delta.value[kFailures] = failed ? 1 : 0;
+    delta.value[kBytesIn] = bytesIn;
+    delta.value[kBytesOut] = bytesOut;
+    delta.value[kExecuteNs] = NowNs() - start;
+    delta.value[kStoredBytes] = storedBytes;
+    Record(operation, delta);
+  }
+
+  Operation operation;
+  size_t bytesIn;
+  size_t storedBytes;
+  uint64_t start;
+  bool done;
+};
+
+} // namespace stats
+} // namespace nodesnappy
+
+#endif // __NODESNAPPY_STATS_H_
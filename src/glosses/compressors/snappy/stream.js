@@ -0,0 +1,53 @@
+const {
+    is,
+    std: { stream: { Transform } }
+} = adone;
+
+/**
+ * Transform stream over a native framing codec (FrameEncoder or FrameDecoder).
+ *
+ * Chunks are compressed or decompressed on the thread pool of the addon, one at a time, so the
+ * event loop is not held up by them. When the pool is full a chunk is done on the event loop
+ * instead of waiting, which slows the producer down in the meantime.
+ */
+export default class FramingStream extends Transform {
+    constructor(codec, options) {
+        super(options);
+        this.codec = codec;
+    }
+
+    _output(res) {
+        if (res && res.length) {
+            this.push(res);
+        }
+    }
+
+    _transform(chunk, encoding, done) {
+        let promise;
+        try {
+            promise = this.codec.writeAsync(chunk);
+            if (is.null(promise)) {
+                this._output(this.codec.write(chunk));
+                done();
+                return;
+            }
+        } catch (e) {
+            done(e);
+            return;
+        }
+
+        promise.then((res) => {
+            this._output(res);
+            done();
+        }, done);
+    }
+
+    _flush(done) {
+        try {
+            this._output(this.codec.end());
+            done();
+        } catch (e) {
+            done(e);
+        }
+    }
+}
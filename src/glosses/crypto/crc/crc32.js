@@ -67,11 +67,28 @@ const TABLE = new Int32Array([
     0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 ]);
 
+// The addon is optional: where it is not built, every buffer takes the table loop
+let native = null;
+try {
+    native = adone.requireAddon(adone.path.join(__dirname, "native", "crc.node"));
+} catch (err) {
+    //
+}
+
+// Below this the call into the addon costs more than the table loop
+const NATIVE_THRESHOLD = 64;
+
 const _crc32 = (buf, previous) => {
     if (!adone.is.buffer(buf)) {
         buf = Buffer.from(buf);
     }
 
+    if (!adone.is.null(native) && buf.length >= NATIVE_THRESHOLD) {
+        // The addon takes the CRC of the preceding data; previous === 0 has
+        // always meant a register of 0 here, which is the CRC 0xffffffff
+        return native.crc32(buf, previous === 0 ? 0xffffffff : ~~previous >>> 0) | 0;
+    }
+
     let crc = previous === 0 ? 0 : ~~previous ^ -1;
 
     for (let index = 0; index < buf.length; index++) {
@@ -1,3 +1,4 @@
 adone.lazify({
-    crc32: "./crc32"
+    crc32: "./crc32",
+    crc32c: "./crc32c"
 }, exports, require);
@@ -0,0 +1,55 @@
+#define NAPI_VERSION 4
+#define NAPI_DISABLE_CPP_EXCEPTIONS
+#include <napi.h>
+
+#include "crc32.h"
+
+namespace adonecrc
+{
+
+typedef uint32_t (*CrcFn)(const char *data, size_t length, uint32_t crc);
+
+// crcXX(buf, previous): previous is the CRC of the data that precedes buf,
+// as an unsigned 32-bit number; missing means none.
+template <CrcFn fn>
+Napi::Value Crc(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsBuffer())
+  {
+    Napi::TypeError::New(env, "First argument must be a buffer").ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  uint32_t previous = 0;
+  if (info.Length() > 1 && !info[1].IsUndefined())
+  {
+    if (!info[1].IsNumber())
+    {
+      Napi::TypeError::New(env, "Previous CRC must be a number").ThrowAsJavaScriptException();
+      return env.Undefined();
+    }
+    previous = info[1].As<Napi::Number>().Uint32Value();
+  }
+
+  Napi::Buffer<char> buf = info[0].As<Napi::Buffer<char>>();
+  return Napi::Number::New(env, fn(buf.Data(), buf.Length(), previous));
+}
+
+Napi::Object Init(Napi::Env env, Napi::Object exports)
+{
+  exports.Set("crc32", Napi::Function::New(env, Crc<adone::crc::Crc32>));
+  exports.Set("crc32c", Napi::Function::New(env, Crc<adone::crc::Crc32c>));
+
+  Napi::Object kernels = Napi::Object::New(env);
+  kernels.Set("crc32", adone::crc::Crc32Variant());
+  kernels.Set("crc32c", adone::crc::Crc32cVariant());
+  exports.Set("kernels", kernels);
+
+  return exports;
+}
+
+NODE_API_MODULE(crc, Init)
+
+} // namespace adonecrc
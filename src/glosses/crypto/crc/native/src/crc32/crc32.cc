@@ -0,0 +1,144 @@
+#include "crc32.h"
+
+namespace adone
+{
+namespace crc
+{
+
+namespace
+{
+
+// Reflected polynomials.
+const uint32_t kCrc32Poly = 0xedb88320;
+const uint32_t kCrc32cPoly = 0x82f63b78;
+
+// tables[0] is the classic byte table; tables[k] advances a byte through
+// k more bytes of zeros, so eight bytes are folded with eight lookups.
+struct Tables
+{
+  explicit Tables(uint32_t poly)
+  {
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t reg = i;
+      for (int j = 0; j < 8; j++)
+        reg = (reg >> 1) ^ (poly & (0 - (reg & 1)));
+      t[0][i] = reg;
+    }
+
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      for (int k = 1; k < 8; k++)
+        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+    }
+  }
+
+  uint32_t t[8][256];
+};
+
+const Tables crc32Tables(kCrc32Poly);
+const Tables crc32cTables(kCrc32cPoly);
+
+inline uint32_t LoadLE32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint32_t Slice8(const Tables &tables, uint32_t reg, const unsigned char *p, size_t length)
+{
+  const uint32_t(*t)[256] = tables.t;
+
+  while (length > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0)
+  {
+    reg = t[0][(reg ^ *p++) & 0xff] ^ (reg >> 8);
+    length--;
+  }
+
+  while (length >= 8)
+  {
+    uint32_t lo = LoadLE32(p) ^ reg;
+    uint32_t hi = LoadLE32(p + 4);
+    reg = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+          t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    p += 8;
+    length -= 8;
+  }
+
+  while (length-- > 0)
+    reg = t[0][(reg ^ *p++) & 0xff] ^ (reg >> 8);
+
+  return reg;
+}
+
+typedef uint32_t (*CrcFn)(uint32_t reg, const unsigned char *p, size_t length);
+
+struct Implementation
+{
+  const char *variant;
+  CrcFn fn;
+};
+
+Implementation SelectCrc32()
+{
+  Implementation res = {"generic", generic::Crc32};
+  if (x86::HasPclmul())
+  {
+    res.variant = "pclmul";
+    res.fn = x86::Crc32;
+  }
+  return res;
+}
+
+Implementation SelectCrc32c()
+{
+  Implementation res = {"generic", generic::Crc32c};
+  if (x86::HasCrc32cInstruction())
+  {
+    res.variant = "sse4.2";
+    res.fn = x86::Crc32c;
+  }
+  return res;
+}
+
+const Implementation crc32 = SelectCrc32();
+const Implementation crc32c = SelectCrc32c();
+
+} // namespace
+
+namespace generic
+{
+
+uint32_t Crc32(uint32_t reg, const unsigned char *p, size_t length)
+{
+  return Slice8(crc32Tables, reg, p, length);
+}
+
+uint32_t Crc32c(uint32_t reg, const unsigned char *p, size_t length)
+{
+  return Slice8(crc32cTables, reg, p, length);
+}
+
+} // namespace generic
+
+uint32_t Crc32(const char *data, size_t length, uint32_t crc)
+{
+  return ~crc32.fn(~crc, reinterpret_cast<const unsigned char *>(data), length);
+}
+
+uint32_t Crc32c(const char *data, size_t length, uint32_t crc)
+{
+  return ~crc32c.fn(~crc, reinterpret_cast<const unsigned char *>(data), length);
+}
+
+const char *Crc32Variant()
+{
+  return crc32.variant;
+}
+
+const char *Crc32cVariant()
+{
+  return crc32c.variant;
+}
+
+} // namespace crc
+} // namespace adone
@@ -0,0 +1,59 @@
+#ifndef __ADONE_CRC32_H_
+#define __ADONE_CRC32_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (the one of zlib, zip and png) and CRC-32C (Castagnoli, the one of
+// iSCSI, ext4 and the snappy framing format).
+//
+// Both take the CRC of the data that precedes the buffer, 0 for none, so
+// Crc32(b, Crc32(a)) is the CRC of a followed by b.
+//
+// Portable builds use slicing-by-8 tables. On x86-64 CPUs with SSE4.2 the
+// CRC-32C uses the crc32 instruction on three interleaved streams, and with
+// PCLMULQDQ the CRC-32 folds 64 bytes per round with carry-less multiplies.
+// The implementation to use is chosen once, at load time.
+
+namespace adone
+{
+namespace crc
+{
+
+uint32_t Crc32(const char *data, size_t length, uint32_t crc = 0);
+uint32_t Crc32c(const char *data, size_t length, uint32_t crc = 0);
+
+// Names of the implementations in use: "pclmul" or "generic" for CRC-32,
+// "sse4.2" or "generic" for CRC-32C.
+const char *Crc32Variant();
+const char *Crc32cVariant();
+
+// The functions below work on the CRC register, which is the complement of
+// the CRC, and are not meant to be called directly.
+
+namespace generic
+{
+
+uint32_t Crc32(uint32_t reg, const unsigned char *p, size_t length);
+uint32_t Crc32c(uint32_t reg, const unsigned char *p, size_t length);
+
+} // namespace generic
+
+namespace x86
+{
+
+// Whether the accelerated versions are part of the binary and the CPU
+// supports them.
+bool HasCrc32cInstruction();
+bool HasPclmul();
+
+// Only to be called when the matching function above returns true.
+uint32_t Crc32c(uint32_t reg, const unsigned char *p, size_t length);
+uint32_t Crc32(uint32_t reg, const unsigned char *p, size_t length);
+
+} // namespace x86
+
+} // namespace crc
+} // namespace adone
+
+#endif // __ADONE_CRC32_H_
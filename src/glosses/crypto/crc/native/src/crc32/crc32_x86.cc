@@ -0,0 +1,303 @@
+#include "crc32.h"
+
+// Versions for x86-64 CPUs with SSE4.2 and PCLMULQDQ, compiled for these
+// features function by function, so the rest of the binary still runs on
+// any CPU. Requires GCC or Clang; elsewhere the generic versions are used.
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define ADONE_CRC_X86 1
+#else
+#define ADONE_CRC_X86 0
+#endif
+
+#if ADONE_CRC_X86
+
+#include <string.h> // memcpy
+
+#include <immintrin.h>
+
+#define ADONE_TARGET(features) __attribute__((target(features)))
+
+namespace adone
+{
+namespace crc
+{
+namespace x86
+{
+
+namespace
+{
+
+const uint32_t kCrc32cPoly = 0x82f63b78;
+
+// Lengths of the three streams that the CRC-32C is computed on at once. The
+// crc32 instruction has a latency of three cycles and a throughput of one,
+// so three independent streams keep it busy.
+const size_t kLong = 8192;
+const size_t kShort = 256;
+
+// Product of two polynomials modulo the CRC polynomial, in reflected order.
+uint32_t MultModP(uint32_t a, uint32_t b)
+{
+  uint32_t m = static_cast<uint32_t>(1) << 31;
+  uint32_t p = 0;
+  for (;;)
+  {
+    if (a & m)
+    {
+      p ^= b;
+      if ((a & (m - 1)) == 0)
+        break;
+    }
+    m >>= 1;
+    b = b & 1 ? (b >> 1) ^ kCrc32cPoly : b >> 1;
+  }
+  return p;
+}
+
+// x^(8 * bytes) modulo the CRC polynomial.
+uint32_t XPow8N(size_t bytes)
+{
+  uint32_t p = static_cast<uint32_t>(1) << 31; // x^0
+  uint32_t square = static_cast<uint32_t>(1) << 23; // x^8
+  for (; bytes > 0; bytes >>= 1)
+  {
+    if (bytes & 1)
+      p = MultModP(square, p);
+    square = MultModP(square, square);
+  }
+  return p;
+}
+
+// Advances a CRC register over `bytes` bytes of zeros with four lookups,
+// which is how the CRCs of the streams are joined.
+struct Shift
+{
+  explicit Shift(size_t bytes)
+  {
+    uint32_t op = XPow8N(bytes);
+    for (uint32_t k = 0; k < 4; k++)
+    {
+      for (uint32_t i = 0; i < 256; i++)
+        t[k][i] = MultModP(op, i << (8 * k));
+    }
+  }
+
+  uint32_t operator()(uint32_t reg) const
+  {
+    return t[0][reg & 0xff] ^ t[1][(reg >> 8) & 0xff] ^ t[2][(reg >> 16) & 0xff] ^ t[3][reg >> 24];
+  }
+
+  uint32_t t[4][256];
+};
+
+inline uint64_t Load64(const unsigned char *p)
+{
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// CRC-32C of three consecutive streams of n bytes each.
+ADONE_TARGET("sse4.2")
+inline uint32_t Crc32cStreams(uint32_t reg, const unsigned char *p, size_t n, const Shift &shift)
+{
+  uint64_t crc0 = reg;
+  uint64_t crc1 = 0;
+  uint64_t crc2 = 0;
+  const unsigned char *end = p + n;
+  do
+  {
+    crc0 = _mm_crc32_u64(crc0, Load64(p));
+    crc1 = _mm_crc32_u64(crc1, Load64(p + n));
+    crc2 = _mm_crc32_u64(crc2, Load64(p + 2 * n));
+    p += 8;
+  } while (p < end);
+
+  reg = shift(static_cast<uint32_t>(crc0)) ^ static_cast<uint32_t>(crc1);
+  return shift(reg) ^ static_cast<uint32_t>(crc2);
+}
+
+} // namespace
+
+bool HasCrc32cInstruction()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2");
+}
+
+bool HasPclmul()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+}
+
+ADONE_TARGET("sse4.2")
+uint32_t Crc32c(uint32_t reg, const unsigned char *p, size_t length)
+{
+  static const Shift shiftLong(kLong);
+  static const Shift shiftShort(kShort);
+
+  while (length > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0)
+  {
+    reg = _mm_crc32_u8(reg, *p++);
+    length--;
+  }
+
+  while (length >= 3 * kLong)
+  {
+    reg = Crc32cStreams(reg, p, kLong, shiftLong);
+    p += 3 * kLong;
+    length -= 3 * kLong;
+  }
+
+  while (length >= 3 * kShort)
+  {
+    reg = Crc32cStreams(reg, p, kShort, shiftShort);
+    p += 3 * kShort;
+    length -= 3 * kShort;
+  }
+
+  uint64_t reg64 = reg;
+  while (length >= 8)
+  {
+    reg64 = _mm_crc32_u64(reg64, Load64(p));
+    p += 8;
+    length -= 8;
+  }
+  reg = static_cast<uint32_t>(reg64);
+
+  while (length-- > 0)
+    reg = _mm_crc32_u8(reg, *p++);
+
+  return reg;
+}
+
+// Folding of "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+// Instruction" (Intel, 2009) with the constants of the reflected CRC-32
+// polynomial given there: four lanes of 16 bytes are folded 64 bytes ahead
+// per round, then into one lane, then reduced to 32 bits (Barrett).
+ADONE_TARGET("sse4.2,pclmul")
+uint32_t Crc32(uint32_t reg, const unsigned char *p, size_t length)
+{
+  if (length < 64)
+    return generic::Crc32(reg, p, length);
+
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+  const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+  const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+  __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+  x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0x00));
+  x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0x10));
+  x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0x20));
+  x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(reg)));
+  p += 64;
+  length -= 64;
+
+  while (length >= 64)
+  {
+    x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0x30)));
+
+    p += 64;
+    length -= 64;
+  }
+
+  // Fold the four lanes into one.
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  // Remaining blocks of 16 bytes.
+  while (length >= 16)
+  {
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i *>(p))), x5);
+    p += 16;
+    length -= 16;
+  }
+
+  // 128 bits to 64.
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask32);
+  x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits.
+  x2 = _mm_and_si128(x1, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+  x2 = _mm_and_si128(x2, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  reg = static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+  return length > 0 ? generic::Crc32(reg, p, length) : reg;
+}
+
+} // namespace x86
+} // namespace crc
+} // namespace adone
+
+#else
+
+namespace adone
+{
+namespace crc
+{
+namespace x86
+{
+
+bool HasCrc32cInstruction()
+{
+  return false;
+}
+
+bool HasPclmul()
+{
+  return false;
+}
+
+uint32_t Crc32c(uint32_t reg, const unsigned char *p, size_t length)
+{
+  return generic::Crc32c(reg, p, length);
+}
+
+uint32_t Crc32(uint32_t reg, const unsigned char *p, size_t length)
+{
+  return generic::Crc32(reg, p, length);
+}
+
+} // namespace x86
+} // namespace crc
+} // namespace adone
+
+#endif // ADONE_CRC_X86
@@ -6,25 +6,84 @@
 /* jshint node:true */
 'use strict';
 
-if (process.platform !== 'darwin') {
+if (process.platform !== 'darwin' && process.platform !== 'linux') {
   throw new Error(`Module 'fsevents' is not compatible with platform '${process.platform}'`);
 }
 
 const Native = adone.requireAddon(adone.path.join(__dirname, "native", "fsevents.node"));
 const con = Native.constants;
 
-function watch(path, handler) {
+// Events of one wakeup of the native watcher. The paths are decoded only when
+// asked for, so a handler that skips events does not pay for them.
+class EventBatch {
+  constructor(flags, ids, offsets, paths) {
+    this.length = flags.length;
+    this._flags = flags;
+    this._ids = ids;
+    this._offsets = offsets;
+    this._paths = Buffer.from(paths.buffer, paths.byteOffset, paths.byteLength);
+  }
+
+  path(index) {
+    return this._paths.toString('utf8', this._offsets[index], this._offsets[index + 1]);
+  }
+
+  flags(index) {
+    return this._flags[index];
+  }
+
+  id(index) {
+    return this._ids[index];
+  }
+
+  *[Symbol.iterator]() {
+    for (let i = 0; i < this.length; i++) {
+      yield { path: this.path(i), flags: this._flags[i], id: this._ids[i] };
+    }
+  }
+}
+
+// options.filesystem: watch the whole filesystem of the path and filter the
+// events natively, with fanotify on Linux, instead of one watch per directory.
+// Needs CAP_SYS_ADMIN; falls back to per-directory watches without it.
+// options.latency: milliseconds during which the events of a path are merged
+// natively before they are handed to the handler.
+// options.storm: number of paths created or removed in one directory, within
+// the latency, beyond which they are reported as one MustScanSubDirs event on
+// it; 0 for no limit. Paths changed in place are always reported.
+//
+// handler(batch) gets an EventBatch per wakeup.
+function watchBatch(path, handler, { filesystem = false, latency = 100, storm = 0 } = {}) {
   if ('string' !== typeof path) throw new TypeError(`argument 1 must be a string and not a ${typeof path}`);
   if ('function' !== typeof handler) throw new TypeError(`argument 2 must be a function and not a ${typeof handler}`);
 
-  let instance = Native.start(path, handler);
+  if (!Number.isInteger(latency) || latency < 0) throw new TypeError(`latency must be a non-negative integer`);
+  if (!Number.isInteger(storm) || storm < 0) throw new TypeError(`storm must be a non-negative integer`);
+
+  const dispatch = (flags, ids, offsets, paths) => handler(new EventBatch(flags, ids, offsets, paths));
+  let instance = Native.start(path, dispatch, filesystem ? con.FSE_WATCH_FILESYSTEM : 0, latency, storm);
   if (!instance) throw new Error(`could not watch: ${path}`);
+  if ('number' === typeof instance) {
+    const code = adone.std.util.getSystemErrorName(-instance);
+    throw Object.assign(new Error(`${code}: could not watch: ${path}`), { code, errno: -instance, path });
+  }
   return () => {
     const result = instance ? Promise.resolve(instance).then(Native.stop) : null;
     instance = null;
     return result;
   };
 }
+// handler(path, flags, id) is called for each event.
+function watch(path, handler, options) {
+  if ('function' !== typeof handler) throw new TypeError(`argument 2 must be a function and not a ${typeof handler}`);
+
+  return watchBatch(path, (batch) => {
+    for (let i = 0; i < batch.length; i++) {
+      handler(batch.path(i), batch.flags(i), batch.id(i));
+    }
+  }, options);
+}
+
 function getInfo(path, flags) {
   return {
     path, flags,
@@ -58,5 +117,7 @@ function getFileChanges(flags) {
 }
 
 exports.watch = watch;
+exports.watchBatch = watchBatch;
+exports.EventBatch = EventBatch;
 exports.getInfo = getInfo;
 exports.constants = con;
@@ -48,9 +48,10 @@ const couldConsolidate = (path) => {
  * @private
  * @param {string} path - path to be watched
  * @param {function} callback - called when fsevents is bound and ready
+ * @param {object} options - options of fsevents watch()
  * @returns {object} new fsevents instance
  */
-const createFSEventsInstance = (path, callback) => new FSEvents(path).on("fsevent", callback).start();
+const createFSEventsInstance = (path, callback, options) => ({ stop: FSEvents.watch(path, callback, options) });
 
 /**
  * Instantiates the fsevents interface or binds listeners to an existing one covering the same file tree
@@ -60,9 +61,10 @@ const createFSEventsInstance = (path, callback) => new FSEvents(path).on("fseven
  * @param {string} realPath - real path (in case of symlinks)
  * @param {function} listener - called when fsevents emits events
  * @param {function} rawEmitter - passes data to listeners of the "raw" event
+ * @param {object} options - options of fsevents watch()
  * @returns {function} close function
  */
-const setFSEventsListener = (path, realPath, listener, rawEmitter) => {
+const setFSEventsListener = (path, realPath, listener, rawEmitter, options) => {
     let watchPath = aPath.extname(path) ? aPath.dirname(path) : path;
     let watchContainer;
     const parentPath = aPath.dirname(watchPath);
@@ -108,7 +110,7 @@ const setFSEventsListener = (path, realPath, listener, rawEmitter) => {
                 const info = FSEvents.getInfo(fullPath, flags);
                 watchContainer.listeners.forEach((listener) => listener(fullPath, flags, info));
                 watchContainer.rawEmitters.forEach((emitter) => emitter(info.event, fullPath, info));
-            })
+            }, options)
         };
         FSEventsWatchers.set(watchPath, watchContainer);
     }
@@ -236,6 +238,15 @@ export default (fs) => {
                         }
                     });
                 };
+                // the native side dropped or collapsed the events below this directory,
+                // compare it with what is watched
+                if (flags & FSEvents.constants.kFSEventStreamEventFlagMustScanSubDirs) {
+                    if (!checkIgnored()) {
+                        this._pruneFsEvents(path);
+                        this._addToFsEvents(path, false, true);
+                    }
+                    return;
+                }
                 // correct for wrong events emitted
                 const wrongEventFlags = [69888, 70400, 71424, 72704, 73472, 131328, 131840, 262912];
                 if (wrongEventFlags.includes(flags) || info.event === "unknown") {
@@ -261,10 +272,41 @@ export default (fs) => {
                 }
             };
 
-            const closer = setFSEventsListener(watchPath, realPath, watchCallback, (...args) => this.emit("raw", ...args));
+            let closer;
+            try {
+                closer = setFSEventsListener(watchPath, realPath, watchCallback, (...args) => this.emit("raw", ...args), {
+                    filesystem: this.options.useFanotify,
+                    ...this.options.coalesce
+                });
+            } catch (err) {
+                // e.g. EMFILE when the inotify instances of the user are exhausted
+                this._handleError(err);
+            }
             this._emitReady();
             return closer;
         },
+        /**
+         * Handle watched paths below a rescanned directory that no longer exist
+         *
+         * @private
+         * @param {string} directory - directory whose events were dropped or collapsed
+         */
+        _pruneFsEvents(directory) {
+            const dir = this._watched.get(aPath.resolve(directory));
+            if (!dir) {
+                return;
+            }
+            for (const item of dir.children()) {
+                const path = aPath.join(directory, item);
+                std.fs.lstat(path, (error) => {
+                    if (!error) {
+                        this._pruneFsEvents(path);
+                    } else if (error.code === "ENOENT" || error.code === "ENOTDIR") {
+                        this._remove(directory, item);
+                    }
+                });
+            }
+        },
         /**
          * Handle added path with fsevents
          *
@@ -634,6 +676,8 @@ export default (fs) => {
             binaryInterval = 300,
             disableGlobbing = false,
             useFsEvents = null,
+            useFanotify = false,
+            coalesce = {},
             usePolling = null,
             atomic = null,
             followSymlinks = true,
@@ -654,7 +698,7 @@ export default (fs) => {
 
             this.enableBinaryInterval = binaryInterval !== interval;
 
-            // Enable fsevents on OS X when polling isn't explicitly enabled.
+            // Enable fsevents on OS X and Linux (inotify) when polling isn't explicitly enabled.
             if (is.null(useFsEvents)) {
                 useFsEvents = !usePolling;
             }
@@ -705,6 +749,8 @@ export default (fs) => {
                 binaryInterval,
                 disableGlobbing,
                 useFsEvents,
+                useFanotify,
+                coalesce,
                 usePolling,
                 atomic,
                 followSymlinks,
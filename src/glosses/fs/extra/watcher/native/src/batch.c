@@ -0,0 +1,84 @@
+#include "rawfsevents.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#ifndef CHECK
+#ifdef NDEBUG
+#define CHECK(x) do { if (!(x)) abort(); } while (0)
+#else
+#define CHECK assert
+#endif
+#endif
+
+#define FSE_BATCH_CAPACITY (16 * 1024)
+
+/* Batches kept for reuse, and the largest one kept: buffers grown by a storm
+** are given back. */
+#define FSE_POOL_SIZE 16
+#define FSE_POOL_CAPACITY (1024 * 1024)
+
+static pthread_mutex_t fse_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static fse_batch_t *fse_pool = NULL;
+static size_t fse_pool_size = 0;
+
+fse_batch_t *fse_batch_alloc() {
+  pthread_mutex_lock(&fse_pool_lock);
+  fse_batch_t *batch = fse_pool;
+  if (batch) {
+    fse_pool = batch->next;
+    fse_pool_size--;
+  }
+  pthread_mutex_unlock(&fse_pool_lock);
+
+  if (!batch) {
+    batch = malloc(sizeof(*batch));
+    CHECK(batch);
+    batch->capacity = FSE_BATCH_CAPACITY;
+    batch->data = malloc(batch->capacity);
+    CHECK(batch->data);
+  }
+  batch->count = 0;
+  batch->bytes = 0;
+  batch->size = 0;
+  batch->next = NULL;
+  return batch;
+}
+
+void fse_batch_release(fse_batch_t *batch) {
+  if (batch->capacity <= FSE_POOL_CAPACITY) {
+    pthread_mutex_lock(&fse_pool_lock);
+    if (fse_pool_size < FSE_POOL_SIZE) {
+      batch->next = fse_pool;
+      fse_pool = batch;
+      fse_pool_size++;
+      batch = NULL;
+    }
+    pthread_mutex_unlock(&fse_pool_lock);
+  }
+  if (batch) {
+    free(batch->data);
+    free(batch);
+  }
+}
+
+void fse_batch_push(fse_batch_t *batch, const char *path, size_t length, unsigned int flags, unsigned long long id) {
+  size_t size = FSE_EVENT_SIZE(length);
+  if (batch->size + size > batch->capacity) {
+    while (batch->size + size > batch->capacity) batch->capacity *= 2;
+    batch->data = realloc(batch->data, batch->capacity);
+    CHECK(batch->data);
+  }
+
+  fse_event_t *event = (fse_event_t *)(batch->data + batch->size);
+  event->id = id;
+  event->flags = flags;
+  event->length = (unsigned int)length;
+  memcpy(event->path, path, length);
+  event->path[length] = 0;
+
+  batch->size += size;
+  batch->bytes += length;
+  batch->count++;
+}
@@ -0,0 +1,275 @@
+#include "coalesce.h"
+#include "constants.h"
+
+#include <assert.h>
+#include <string.h>
+
+#ifndef CHECK
+#ifdef NDEBUG
+#define CHECK(x) do { if (!(x)) abort(); } while (0)
+#else
+#define CHECK assert
+#endif
+#endif
+
+/* Keys of the hash tables below; first member of their records. */
+typedef struct {
+  const char *path;
+  size_t len;
+} fse_key_t;
+
+typedef struct {
+  fse_key_t key;
+  unsigned int flags; /* 0 once cancelled */
+  unsigned int first; /* flags of the first event of the path */
+  unsigned long long id;
+} fse_entry_t;
+
+typedef struct {
+  fse_key_t key;
+  size_t count;
+  unsigned long long id;
+  int emitted;
+} fse_dir_t;
+
+/* Paths of the entries, in chunks that never move; all of them are reused
+** by the next window. */
+#define FSE_CHUNK_SIZE (64 * 1024)
+
+typedef struct fse_chunk_s {
+  struct fse_chunk_s *next;
+  size_t size;
+  size_t used;
+  char data[];
+} fse_chunk_t;
+
+/* Open addressing table of record indexes, plus one, with linear probing. */
+typedef struct {
+  size_t *slots;
+  size_t mask;
+} fse_table_t;
+
+struct fse_coalescer_s {
+  unsigned int storm;
+  fse_entry_t *entries;
+  size_t count;
+  size_t capacity;
+  fse_table_t table;
+  fse_chunk_t *chunks; /* the current one first */
+  fse_chunk_t *spare;
+};
+
+static size_t fse_hash(const char *path, size_t len) {
+  size_t hash = 2166136261u;
+  size_t idx;
+  for (idx = 0; idx < len; idx++) hash = (hash ^ (unsigned char)path[idx]) * 16777619u;
+  return hash;
+}
+
+static void fse_table_init(fse_table_t *table, size_t size) {
+  size_t n = 64;
+  while (n < size * 2) n *= 2;
+  table->slots = calloc(n, sizeof(*table->slots));
+  CHECK(table->slots);
+  table->mask = n - 1;
+}
+
+/* Slot of the key, either holding it or empty. Records are `stride` bytes
+** apart and start with their key. */
+static size_t *fse_table_find(fse_table_t *table, const void *records, size_t stride, const char *path, size_t len) {
+  size_t idx = fse_hash(path, len) & table->mask;
+  for (;; idx = (idx + 1) & table->mask) {
+    size_t *slot = &table->slots[idx];
+    if (!*slot) return slot;
+    const fse_key_t *key = (const fse_key_t *)((const char *)records + (*slot - 1) * stride);
+    if (key->len == len && !memcmp(key->path, path, len)) return slot;
+  }
+}
+
+static void fse_table_grow(fse_table_t *table, const void *records, size_t stride, size_t count) {
+  if (count * 2 <= table->mask + 1) return;
+  free(table->slots);
+  fse_table_init(table, count);
+  size_t idx;
+  for (idx = 0; idx < count; idx++) {
+    const fse_key_t *key = (const fse_key_t *)((const char *)records + idx * stride);
+    *fse_table_find(table, records, stride, key->path, key->len) = idx + 1;
+  }
+}
+
+static char *fse_copy_path(fse_coalescer_t *coalescer, const char *path, size_t len) {
+  fse_chunk_t *chunk = coalescer->chunks;
+  if (!chunk || chunk->used + len + 1 > chunk->size) {
+    if (coalescer->spare && len + 1 <= coalescer->spare->size) {
+      chunk = coalescer->spare;
+      coalescer->spare = chunk->next;
+    } else {
+      size_t size = len + 1 > FSE_CHUNK_SIZE ? len + 1 : FSE_CHUNK_SIZE;
+      chunk = malloc(sizeof(*chunk) + size);
+      CHECK(chunk);
+      chunk->size = size;
+    }
+    chunk->used = 0;
+    chunk->next = coalescer->chunks;
+    coalescer->chunks = chunk;
+  }
+  char *copy = chunk->data + chunk->used;
+  memcpy(copy, path, len);
+  copy[len] = 0;
+  chunk->used += len + 1;
+  return copy;
+}
+
+static void fse_free_chunks(fse_chunk_t *chunk) {
+  while (chunk) {
+    fse_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+}
+
+fse_coalescer_t *fse_coalescer_alloc(unsigned int storm) {
+  fse_coalescer_t *coalescer = calloc(1, sizeof(*coalescer));
+  CHECK(coalescer);
+  coalescer->storm = storm;
+  fse_table_init(&coalescer->table, 0);
+  return coalescer;
+}
+
+static void fse_coalescer_reset(fse_coalescer_t *coalescer) {
+  /* The chunks of this window serve the next one; those that the last
+  ** window left unused are freed. */
+  fse_free_chunks(coalescer->spare);
+  coalescer->spare = coalescer->chunks;
+  coalescer->chunks = NULL;
+  coalescer->count = 0;
+  memset(coalescer->table.slots, 0, sizeof(*coalescer->table.slots) * (coalescer->table.mask + 1));
+}
+
+void fse_coalescer_free(fse_coalescer_t *coalescer) {
+  fse_coalescer_reset(coalescer);
+  fse_free_chunks(coalescer->spare);
+  free(coalescer->entries);
+  free(coalescer->table.slots);
+  free(coalescer);
+}
+
+size_t fse_coalescer_size(fse_coalescer_t *coalescer) {
+  return coalescer->count;
+}
+
+static void fse_merge(fse_entry_t *entry, const fse_event_t *event) {
+  unsigned int removed = kFSEventStreamEventFlagItemRemoved;
+  unsigned int created = kFSEventStreamEventFlagItemCreated;
+  entry->id = event->id;
+  if (!entry->flags) {
+    entry->flags = entry->first = event->flags;
+  } else if ((entry->first & created) && !(entry->first & removed) && (event->flags & removed) && !(event->flags & created)) {
+    /* Born and gone within the window. */
+    entry->flags = 0;
+  } else {
+    entry->flags |= event->flags;
+  }
+}
+
+/* Whether a rescan of the directory tells what happened to the path: it
+** appeared or went away. A change in place, or a path replaced within the
+** window, only shows in its own event. */
+static int fse_collapsible(unsigned int flags) {
+  unsigned int changed = kFSEventStreamEventFlagItemModified | kFSEventStreamEventFlagItemInodeMetaMod |
+                         kFSEventStreamEventFlagItemFinderInfoMod | kFSEventStreamEventFlagItemChangeOwner |
+                         kFSEventStreamEventFlagItemXattrMod;
+  if (flags & kFSEventStreamEventFlagItemCreated) return !(flags & kFSEventStreamEventFlagItemRemoved);
+  return !(flags & changed);
+}
+
+void fse_coalescer_add(fse_coalescer_t *coalescer, const fse_batch_t *batch) {
+  size_t idx;
+  const fse_event_t *event = fse_batch_first(batch);
+  for (idx = 0; idx < batch->count; idx++, event = fse_batch_next(event)) {
+    size_t len = event->length;
+    size_t *slot = fse_table_find(&coalescer->table, coalescer->entries, sizeof(fse_entry_t), event->path, len);
+    if (*slot) {
+      fse_merge(&coalescer->entries[*slot - 1], event);
+      continue;
+    }
+
+    if (coalescer->count == coalescer->capacity) {
+      coalescer->capacity = coalescer->capacity ? coalescer->capacity * 2 : 64;
+      coalescer->entries = realloc(coalescer->entries, sizeof(*coalescer->entries) * coalescer->capacity);
+      CHECK(coalescer->entries);
+    }
+    fse_entry_t *entry = &coalescer->entries[coalescer->count];
+    entry->key.path = fse_copy_path(coalescer, event->path, len);
+    entry->key.len = len;
+    entry->flags = 0;
+    fse_merge(entry, event);
+    *slot = ++coalescer->count;
+    fse_table_grow(&coalescer->table, coalescer->entries, sizeof(fse_entry_t), coalescer->count);
+  }
+}
+
+fse_batch_t *fse_coalescer_take(fse_coalescer_t *coalescer) {
+  size_t idx;
+  fse_dir_t *dirs = NULL;
+  fse_table_t table = { NULL, 0 };
+  size_t ndirs = 0;
+
+  if (!coalescer->count) return NULL;
+
+  /* Changes per parent directory, if storms are collapsed. */
+  if (coalescer->storm && coalescer->count > coalescer->storm) {
+    dirs = malloc(sizeof(*dirs) * coalescer->count);
+    CHECK(dirs);
+    fse_table_init(&table, coalescer->count);
+    for (idx = 0; idx < coalescer->count; idx++) {
+      const fse_entry_t *entry = &coalescer->entries[idx];
+      const char *slash = entry->flags && fse_collapsible(entry->flags) ? strrchr(entry->key.path, '/') : NULL;
+      if (!slash || slash == entry->key.path) continue;
+      size_t len = slash - entry->key.path;
+      size_t *slot = fse_table_find(&table, dirs, sizeof(fse_dir_t), entry->key.path, len);
+      if (!*slot) {
+        fse_dir_t *dir = &dirs[ndirs];
+        dir->key.path = entry->key.path;
+        dir->key.len = len;
+        dir->count = 0;
+        dir->id = 0;
+        dir->emitted = 0;
+        *slot = ++ndirs;
+      }
+      fse_dir_t *dir = &dirs[*slot - 1];
+      dir->count++;
+      if (entry->id > dir->id) dir->id = entry->id;
+    }
+  }
+
+  fse_batch_t *batch = fse_batch_alloc();
+  for (idx = 0; idx < coalescer->count; idx++) {
+    const fse_entry_t *entry = &coalescer->entries[idx];
+    if (!entry->flags) continue;
+
+    const char *slash = dirs && fse_collapsible(entry->flags) ? strrchr(entry->key.path, '/') : NULL;
+    if (slash && slash != entry->key.path) {
+      fse_dir_t *dir = &dirs[*fse_table_find(&table, dirs, sizeof(fse_dir_t), entry->key.path, slash - entry->key.path) - 1];
+      if (dir->count > coalescer->storm) {
+        if (!dir->emitted) {
+          fse_batch_push(batch, dir->key.path, dir->key.len,
+                         kFSEventStreamEventFlagMustScanSubDirs | kFSEventStreamEventFlagItemIsDir, dir->id);
+          dir->emitted = 1;
+        }
+        continue;
+      }
+    }
+    fse_batch_push(batch, entry->key.path, entry->key.len, entry->flags, entry->id);
+  }
+
+  free(dirs);
+  free(table.slots);
+  fse_coalescer_reset(coalescer);
+
+  if (!batch->count) {
+    fse_batch_release(batch);
+    return NULL;
+  }
+  return batch;
+}
@@ -0,0 +1,39 @@
+#ifndef __coalesce_h
+#define __coalesce_h
+
+#include "rawfsevents.h"
+
+/*
+** Merges the events of a latency window before they are handed on.
+**
+** Events of the same path become one, in the place of the first, with the
+** flags of all of them and the id of the last: repeated modifications are
+** reported once, and a removal followed by a creation is reported as both,
+** as FSEvents does. A path that is created and then removed within the
+** window is not reported at all.
+**
+** With a storm threshold, when more paths than that appeared or went away
+** directly in the same directory, they are replaced by one MustScanSubDirs
+** event on the directory, which tells the receiver to rescan it and compare
+** it with what it knew. Paths changed in place are still reported one by
+** one, as a rescan cannot tell them.
+*/
+
+typedef struct fse_coalescer_s fse_coalescer_t;
+
+/* Beyond this many paths, the owner should not wait for the window to end. */
+#define FSE_COALESCE_MAX 65536
+
+fse_coalescer_t *fse_coalescer_alloc(unsigned int storm);
+void fse_coalescer_free(fse_coalescer_t *coalescer);
+
+void fse_coalescer_add(fse_coalescer_t *coalescer, const fse_batch_t *batch);
+
+/* Number of distinct paths waiting. */
+size_t fse_coalescer_size(fse_coalescer_t *coalescer);
+
+/* Returns the merged events and starts a new window; NULL if nothing is
+** waiting. */
+fse_batch_t *fse_coalescer_take(fse_coalescer_t *coalescer);
+
+#endif
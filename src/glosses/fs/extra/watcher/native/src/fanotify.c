@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+
+#include "fanotify.h"
+#include "constants.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+
+#ifndef FAN_REPORT_DFID_NAME
+#define FAN_REPORT_DIR_FID 0x00000400
+#define FAN_REPORT_NAME 0x00000800
+#define FAN_REPORT_DFID_NAME (FAN_REPORT_DIR_FID | FAN_REPORT_NAME)
+#define FAN_EVENT_INFO_TYPE_DFID_NAME 2
+#endif
+
+#ifndef FAN_MARK_FILESYSTEM
+#define FAN_MARK_FILESYSTEM 0x00000100
+#endif
+
+#define FSE_FAN_MASK (FAN_CREATE | FAN_DELETE | FAN_MODIFY | FAN_ATTRIB | FAN_MOVED_FROM | FAN_MOVED_TO | \
+                      FAN_DELETE_SELF | FAN_MOVE_SELF | FAN_ONDIR)
+
+#define FSE_HANDLE_SIZE 128
+
+struct fse_fanotify_s {
+  int fd;
+  int mountfd; /* resolves the file handles of the events */
+  char root[PATH_MAX];
+  size_t rootlen;
+  struct {
+    struct file_handle handle;
+    unsigned char bytes[FSE_HANDLE_SIZE];
+  } roothandle;
+
+  /* Last resolved directory: events come in runs on the same one. */
+  unsigned char last[sizeof(struct file_handle) + FSE_HANDLE_SIZE];
+  size_t lastsize;
+  char lastpath[PATH_MAX];
+};
+
+fse_fanotify_t *fse_fanotify_open(const char *root) {
+  fse_fanotify_t *fan = calloc(1, sizeof(*fan));
+  if (!fan) return NULL;
+  fan->fd = fan->mountfd = -1;
+  strncpy(fan->root, root, sizeof(fan->root) - 1);
+  fan->rootlen = strlen(fan->root);
+  while (fan->rootlen > 1 && fan->root[fan->rootlen - 1] == '/') fan->root[--fan->rootlen] = 0;
+
+  int mountid, err;
+  fan->roothandle.handle.handle_bytes = FSE_HANDLE_SIZE;
+  if (name_to_handle_at(AT_FDCWD, fan->root, &fan->roothandle.handle, &mountid, 0) < 0 ||
+      (fan->mountfd = open(fan->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 ||
+      (fan->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY | O_CLOEXEC)) < 0 ||
+      fanotify_mark(fan->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FSE_FAN_MASK, AT_FDCWD, fan->root) < 0) {
+    err = errno;
+    fse_fanotify_close(fan);
+    errno = err;
+    return NULL;
+  }
+  return fan;
+}
+
+void fse_fanotify_close(fse_fanotify_t *fan) {
+  if (fan->fd >= 0) close(fan->fd);
+  if (fan->mountfd >= 0) close(fan->mountfd);
+  free(fan);
+}
+
+int fse_fanotify_fd(fse_fanotify_t *fan) {
+  return fan->fd;
+}
+
+static size_t fse_handle_size(const struct file_handle *handle) {
+  return sizeof(*handle) + handle->handle_bytes;
+}
+
+/* Path of a directory, or NULL if it is gone. */
+static const char *fse_resolve(fse_fanotify_t *fan, const struct file_handle *handle) {
+  size_t size = fse_handle_size(handle);
+  if (size == fan->lastsize && !memcmp(fan->last, handle, size)) return fan->lastpath;
+  if (size > sizeof(fan->last)) return NULL;
+
+  int fd = open_by_handle_at(fan->mountfd, (struct file_handle *)handle, O_PATH | O_CLOEXEC);
+  if (fd < 0) return NULL;
+  char link[32];
+  snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+  ssize_t n = readlink(link, fan->lastpath, sizeof(fan->lastpath) - 1);
+  close(fd);
+  if (n < 0) {
+    fan->lastsize = 0;
+    return NULL;
+  }
+  fan->lastpath[n] = 0;
+  memcpy(fan->last, handle, size);
+  fan->lastsize = size;
+  return fan->lastpath;
+}
+
+static int fse_is_root(fse_fanotify_t *fan, const struct file_handle *handle) {
+  size_t size = fse_handle_size(handle);
+  return size == fse_handle_size(&fan->roothandle.handle) && !memcmp(handle, &fan->roothandle.handle, size);
+}
+
+static int fse_below_root(fse_fanotify_t *fan, const char *path) {
+  if (fan->rootlen == 1) return path[0] == '/';
+  return !strncmp(path, fan->root, fan->rootlen) && (path[fan->rootlen] == 0 || path[fan->rootlen] == '/');
+}
+
+static unsigned int fse_flags_of(unsigned long long mask, const char *path) {
+  unsigned int flags = kFSEventStreamEventFlagNone;
+  if (mask & FAN_CREATE) flags |= kFSEventStreamEventFlagItemCreated;
+  if (mask & FAN_DELETE) flags |= kFSEventStreamEventFlagItemRemoved;
+  if (mask & FAN_MODIFY) flags |= kFSEventStreamEventFlagItemModified;
+  if (mask & FAN_ATTRIB) flags |= kFSEventStreamEventFlagItemInodeMetaMod;
+  if (mask & (FAN_MOVED_FROM | FAN_MOVED_TO)) flags |= kFSEventStreamEventFlagItemRenamed;
+
+  if (mask & FAN_ONDIR) {
+    flags |= kFSEventStreamEventFlagItemIsDir;
+  } else if (mask & FAN_CREATE) {
+    struct stat st;
+    flags |= !lstat(path, &st) && S_ISLNK(st.st_mode) ? kFSEventStreamEventFlagItemIsSymlink : kFSEventStreamEventFlagItemIsFile;
+  } else {
+    flags |= kFSEventStreamEventFlagItemIsFile;
+  }
+  return flags;
+}
+
+void fse_fanotify_translate(fse_fanotify_t *fan, const char *buf, ssize_t len, fse_batch_t *batch, unsigned long long *id) {
+  char path[PATH_MAX];
+  const struct fanotify_event_metadata *meta = (const struct fanotify_event_metadata *)buf;
+  for (; FAN_EVENT_OK(meta, len); meta = FAN_EVENT_NEXT(meta, len)) {
+    if (meta->vers != FANOTIFY_METADATA_VERSION) continue;
+
+    if (meta->mask & FAN_Q_OVERFLOW) {
+      fse_batch_push(batch, fan->root, fan->rootlen, kFSEventStreamEventFlagMustScanSubDirs | kFSEventStreamEventFlagKernelDropped, ++*id);
+      continue;
+    }
+
+    const struct fanotify_event_info_fid *info = (const struct fanotify_event_info_fid *)(meta + 1);
+    if (meta->event_len < sizeof(*meta) + sizeof(*info) || info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) continue;
+    const struct file_handle *handle = (const struct file_handle *)info->handle;
+    const char *name = (const char *)handle->f_handle + handle->handle_bytes;
+    int self = !name[0] || !strcmp(name, ".");
+
+    if (meta->mask & (FAN_DELETE_SELF | FAN_MOVE_SELF)) {
+      /* Other directories are reported by their parent, as with inotify. */
+      if (self && fse_is_root(fan, handle)) {
+        fse_batch_push(batch, fan->root, fan->rootlen, kFSEventStreamEventFlagRootChanged, ++*id);
+      }
+      continue;
+    }
+
+    const char *dir = fse_resolve(fan, handle);
+    if (!dir) continue;
+    int length = self ? snprintf(path, sizeof(path), "%s", dir) : snprintf(path, sizeof(path), "%s/%s", strcmp(dir, "/") ? dir : "", name);
+    if (length >= (int)sizeof(path) || !fse_below_root(fan, path)) continue;
+
+    unsigned int flags;
+    if (!strcmp(path, fan->root) && (meta->mask & (FAN_DELETE | FAN_MOVED_FROM))) {
+      /* Reported by the parent, before or instead of the self event. */
+      flags = kFSEventStreamEventFlagRootChanged;
+    } else {
+      flags = fse_flags_of(meta->mask, path);
+    }
+    fse_batch_push(batch, path, length, flags, ++*id);
+  }
+}
@@ -0,0 +1,29 @@
+#ifndef __fanotify_h
+#define __fanotify_h
+
+#include <sys/types.h>
+
+#include "rawfsevents.h"
+
+/*
+** Whole-filesystem watching with fanotify, for rawfsevents_inotify.c.
+**
+** One mark on the filesystem of the root covers every directory below it,
+** whatever their number, so there is no crawl and no watch per directory.
+** Requires Linux 5.9 (FAN_REPORT_DFID_NAME) and CAP_SYS_ADMIN for the
+** filesystem mark; fse_fanotify_open() fails otherwise and the caller
+** falls back to inotify.
+*/
+
+typedef struct fse_fanotify_s fse_fanotify_t;
+
+/* Returns NULL, with errno set, if fanotify cannot watch root. */
+fse_fanotify_t *fse_fanotify_open(const char *root);
+void fse_fanotify_close(fse_fanotify_t *fan);
+int fse_fanotify_fd(fse_fanotify_t *fan);
+
+/* Appends the events of a buffer read from the descriptor that are below
+** the root to the batch, numbered after *id. */
+void fse_fanotify_translate(fse_fanotify_t *fan, const char *buf, ssize_t len, fse_batch_t *batch, unsigned long long *id);
+
+#endif
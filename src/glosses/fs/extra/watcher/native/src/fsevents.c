@@ -4,6 +4,7 @@
 */
 
 #include <assert.h>
+#include <string.h>
 
 #define NAPI_VERSION 4
 #include <node_api.h>
@@ -20,34 +21,64 @@
 #endif
 
 
-typedef struct {
-  size_t count;
-  fse_event_t *events;
-} fse_js_event;
-
-void fse_propagate_event(void *callback, size_t numevents, fse_event_t *events) {
-  fse_js_event *event = malloc(sizeof(*event));
-  CHECK(event);
-  event->count = numevents;
-  event->events = events;
-  CHECK(napi_call_threadsafe_function((napi_threadsafe_function)callback, event, napi_tsfn_blocking) == napi_ok);
+void fse_propagate_event(void *callback, fse_batch_t *batch) {
+  /* Fails once the environment is going away. */
+  if (napi_call_threadsafe_function((napi_threadsafe_function)callback, batch, napi_tsfn_blocking) != napi_ok) {
+    fse_batch_release(batch);
+  }
 }
 
+/*
+** A batch reaches JS in one call, as views of one ArrayBuffer:
+**
+**   flags    Uint32Array(count)
+**   ids      Float64Array(count)
+**   offsets  Uint32Array(count + 1), the paths are paths[offsets[i], offsets[i + 1])
+**   paths    Uint8Array, the UTF-8 paths joined
+**
+** so that JS only pays for the paths it decodes.
+*/
 void fse_dispatch_events(napi_env env, napi_value callback, void* context, void* data) {
-  fse_js_event *event = data;
-  napi_value recv, args[3];
-  size_t idx;
-  CHECK(napi_get_null(env, &recv) == napi_ok);
+  fse_batch_t *batch = data;
+  if (env == NULL) {
+    fse_batch_release(batch);
+    return;
+  }
 
-  for (idx = 0; idx < event->count; idx++) {
-    CHECK(napi_create_string_utf8(env, event->events[idx].path, NAPI_AUTO_LENGTH, &args[0]) == napi_ok);
-    CHECK(napi_create_uint32(env, event->events[idx].flags, &args[1]) == napi_ok);
-    CHECK(napi_create_int64(env, event->events[idx].id, &args[2]) == napi_ok);
-    CHECK(napi_call_function(env, recv, callback, 3, args, &recv) == napi_ok);
+  size_t count = batch->count, bytes = batch->bytes, idx;
+
+  /* Float64 first, so that every view is aligned. */
+  size_t idsAt = 0;
+  size_t flagsAt = idsAt + count * sizeof(double);
+  size_t offsetsAt = flagsAt + count * sizeof(uint32_t);
+  size_t pathsAt = offsetsAt + (count + 1) * sizeof(uint32_t);
+
+  napi_value buffer, recv, args[4], result;
+  void *base;
+  CHECK(napi_create_arraybuffer(env, pathsAt + bytes, &base, &buffer) == napi_ok);
+  double *ids = (double *)((char *)base + idsAt);
+  uint32_t *flags = (uint32_t *)((char *)base + flagsAt);
+  uint32_t *offsets = (uint32_t *)((char *)base + offsetsAt);
+  char *paths = (char *)base + pathsAt;
+
+  uint32_t offset = 0;
+  fse_event_t *event = fse_batch_first(batch);
+  for (idx = 0; idx < count; idx++, event = fse_batch_next(event)) {
+    memcpy(paths + offset, event->path, event->length);
+    ids[idx] = (double)event->id;
+    flags[idx] = event->flags;
+    offsets[idx] = offset;
+    offset += event->length;
   }
+  offsets[count] = offset;
+  fse_batch_release(batch);
 
-  free(event->events);
-  free(event);
+  CHECK(napi_create_typedarray(env, napi_uint32_array, count, buffer, flagsAt, &args[0]) == napi_ok);
+  CHECK(napi_create_typedarray(env, napi_float64_array, count, buffer, idsAt, &args[1]) == napi_ok);
+  CHECK(napi_create_typedarray(env, napi_uint32_array, count + 1, buffer, offsetsAt, &args[2]) == napi_ok);
+  CHECK(napi_create_typedarray(env, napi_uint8_array, bytes, buffer, pathsAt, &args[3]) == napi_ok);
+  CHECK(napi_get_null(env, &recv) == napi_ok);
+  napi_call_function(env, recv, callback, 4, args, &result);
 }
 
 void fse_free_watcher(napi_env env, void* watcher, void* callback) {
@@ -70,13 +101,17 @@ void fse_watcher_ended(void *context) {
 }
 
 static napi_value FSEStart(napi_env env, napi_callback_info info) {
-  size_t argc = 2;
+  size_t argc = 5;
   napi_value argv[argc];
   char path[PATH_MAX];
+  fse_options_t options = { 0, 0, 0 };
   napi_threadsafe_function callback = NULL;
   napi_value asyncResource, asyncName;
 
   CHECK(napi_get_cb_info(env, info, &argc, argv,  NULL, NULL) == napi_ok);
+  if (argc > 2) napi_get_value_uint32(env, argv[2], &options.flags);
+  if (argc > 3) napi_get_value_uint32(env, argv[3], &options.latency);
+  if (argc > 4) napi_get_value_uint32(env, argv[4], &options.storm);
   CHECK(napi_get_value_string_utf8(env, argv[0], path, PATH_MAX, &argc) == napi_ok);
   CHECK(napi_create_object(env, &asyncResource) == napi_ok);
   CHECK(napi_create_string_utf8(env, "fsevents", NAPI_AUTO_LENGTH, &asyncName) == napi_ok);
@@ -90,7 +125,14 @@ static napi_value FSEStart(napi_env env, napi_callback_info info) {
   }
   fse_watcher_t watcher = fse_alloc();
   CHECK(watcher);
-  fse_watch(path, fse_propagate_event, callback, fse_watcher_started, fse_watcher_ended, watcher);
+  int error = fse_watch(path, &options, fse_propagate_event, callback, fse_watcher_started, fse_watcher_ended, watcher);
+  if (error) {
+    /* Nothing started, JS throws the errno value. */
+    fse_free(watcher);
+    CHECK(napi_release_threadsafe_function(callback, napi_tsfn_abort) == napi_ok);
+    CHECK(napi_create_int32(env, error, &result) == napi_ok);
+    return result;
+  }
 
   CHECK(napi_create_external(env, watcher, fse_free_watcher, callback, &result) == napi_ok);
   return result;
@@ -148,6 +190,7 @@ napi_value Init(napi_env env, napi_value exports) {
   CONSTANT(kFSEventStreamEventFlagItemIsFile);
   CONSTANT(kFSEventStreamEventFlagItemIsDir);
   CONSTANT(kFSEventStreamEventFlagItemIsSymlink);
+  CONSTANT(FSE_WATCH_FILESYSTEM);
 
   return exports;
 }
@@ -1,4 +1,5 @@
 #include "rawfsevents.h"
+#include "coalesce.h"
 #include "CoreFoundation/CoreFoundation.h"
 #include "CoreServices/CoreServices.h"
 #include <pthread.h>
@@ -22,6 +23,8 @@ typedef struct {
 struct fse_watcher_s {
   char path[PATH_MAX];
   FSEventStreamRef stream;
+  CFAbsoluteTime latency;
+  fse_coalescer_t *coalescer;
   fse_event_handler_t handler;
   fse_thread_hook_t hookend;
   void *context;
@@ -65,20 +68,27 @@ void fse_handle_events(
 ) {
   fse_watcher_t watcher = data;
   if (!watcher->handler) return;
-  fse_event_t *events = malloc(sizeof(*events) * numEvents);
-  CHECK(events);
+  fse_batch_t *batch = fse_batch_alloc();
+  char buffer[PATH_MAX];
   size_t idx;
   for (idx=0; idx < numEvents; idx++) {
-    fse_event_t *event = &events[idx];
     CFStringRef path = (CFStringRef)CFArrayGetValueAtIndex((CFArrayRef)eventPaths, idx);
-    strncpy(event->path, CFStringGetCStringPtr(path, kCFStringEncodingUTF8), sizeof(event->path));
-    event->id = eventIds[idx];
-    event->flags = eventFlags[idx];
+    const char *cpath = CFStringGetCStringPtr(path, kCFStringEncodingUTF8);
+    if (!cpath && CFStringGetCString(path, buffer, sizeof(buffer), kCFStringEncodingUTF8)) cpath = buffer;
+    if (cpath) fse_batch_push(batch, cpath, strlen(cpath), eventFlags[idx], eventIds[idx]);
   }
-  if (!watcher->handler) {
-    free(events);
+  /* FSEvents already merges the events of the latency; only storms are
+  ** left to collapse. */
+  if (watcher->coalescer) {
+    fse_coalescer_add(watcher->coalescer, batch);
+    fse_batch_release(batch);
+    batch = fse_coalescer_take(watcher->coalescer);
+  }
+  if (!batch) return;
+  if (!watcher->handler || !batch->count) {
+    fse_batch_release(batch);
   } else {
-    watcher->handler(watcher->context, numEvents, events);
+    watcher->handler(watcher->context, batch);
   }
 }
 
@@ -86,6 +96,8 @@ void fse_clear(fse_watcher_t watcher) {
   watcher->path[0] = 0;
   watcher->handler = NULL;
   watcher->stream = NULL;
+  watcher->latency = 0.1;
+  watcher->coalescer = NULL;
   watcher->context = NULL;
   watcher->hookend = NULL;
 }
@@ -102,7 +114,7 @@ void fse_free(fse_watcher_t watcher) {
   free(watcher);
 }
 
-void fse_watch(const char *path, fse_event_handler_t handler, void *context, fse_thread_hook_t hookstart, fse_thread_hook_t hookend, fse_watcher_t watcher) {
+int fse_watch(const char *path, const fse_options_t *options, fse_event_handler_t handler, void *context, fse_thread_hook_t hookstart, fse_thread_hook_t hookend, fse_watcher_t watcher) {
   pthread_mutex_lock(&fsevents.lock);
   if (!fsevents.loop) {
     pthread_create(&fsevents.thread, NULL, fse_run_loop, NULL);
@@ -111,22 +123,26 @@ void fse_watch(const char *path, fse_event_handler_t handler, void *context, fse
   }
 
   strncpy(watcher->path, path, PATH_MAX);
+  watcher->latency = options->latency / 1000.0;
+  if (options->storm) watcher->coalescer = fse_coalescer_alloc(options->storm);
   watcher->handler = handler;
   watcher->context = context;
   CFRunLoopPerformBlock(fsevents.loop, kCFRunLoopDefaultMode, ^(void){
     if (hookstart) hookstart(watcher->context);
     FSEventStreamContext streamcontext = { 0, watcher, NULL, NULL, NULL };
     CFStringRef dirs[] = { CFStringCreateWithCString(NULL, watcher->path, kCFStringEncodingUTF8) };
-    watcher->stream = FSEventStreamCreate(NULL, &fse_handle_events, &streamcontext, CFArrayCreate(NULL, (const void **)&dirs, 1, NULL), kFSEventStreamEventIdSinceNow, (CFAbsoluteTime) 0.1, kFSEventStreamCreateFlagNone | kFSEventStreamCreateFlagWatchRoot | kFSEventStreamCreateFlagFileEvents | kFSEventStreamCreateFlagUseCFTypes);
+    watcher->stream = FSEventStreamCreate(NULL, &fse_handle_events, &streamcontext, CFArrayCreate(NULL, (const void **)&dirs, 1, NULL), kFSEventStreamEventIdSinceNow, watcher->latency, kFSEventStreamCreateFlagNone | kFSEventStreamCreateFlagWatchRoot | kFSEventStreamCreateFlagFileEvents | kFSEventStreamCreateFlagUseCFTypes);
     FSEventStreamScheduleWithRunLoop(watcher->stream, fsevents.loop, kCFRunLoopDefaultMode);
     FSEventStreamStart(watcher->stream);
   });
   CFRunLoopWakeUp(fsevents.loop);
   pthread_mutex_unlock(&fsevents.lock);
+  return 0;
 }
 
 void fse_unwatch(fse_watcher_t watcher) {
   FSEventStreamRef stream = watcher->stream;
+  fse_coalescer_t *coalescer = watcher->coalescer;
   fse_thread_hook_t hookend = watcher->hookend;
   void *context = watcher->context;
   fse_clear(watcher);
@@ -140,6 +156,7 @@ void fse_unwatch(fse_watcher_t watcher) {
         FSEventStreamInvalidate(stream);
         FSEventStreamRelease(stream);
       }
+      if (coalescer) fse_coalescer_free(coalescer);
       if (hookend) hookend(context);
     });
   }
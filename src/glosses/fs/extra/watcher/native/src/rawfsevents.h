@@ -4,20 +4,67 @@
 #include <stdlib.h>
 #include <limits.h>
 
+/* Event record of a batch, as long as its path needs. */
 typedef struct {
   unsigned long long id;
-  char path[PATH_MAX];
   unsigned int flags;
+  unsigned int length; /* of the path, without the NUL */
+  char path[];
 } fse_event_t;
 
-typedef void (*fse_event_handler_t)(void *context, size_t numevents, fse_event_t *events);
+/*
+** Events are handed on in batches: records packed one after another, each
+** aligned to 8 bytes, in one buffer. Batches are recycled through a small
+** process-wide pool, so a steady stream of events does not allocate.
+*/
+typedef struct fse_batch_s {
+  size_t count;
+  size_t bytes; /* of the paths, without their NULs */
+  size_t size; /* of the records */
+  size_t capacity;
+  char *data;
+  struct fse_batch_s *next; /* in the pool */
+} fse_batch_t;
+
+#define FSE_EVENT_SIZE(length) ((sizeof(fse_event_t) + (length) + 1 + 7) & ~(size_t)7)
+
+#define fse_batch_first(batch) ((fse_event_t *)(batch)->data)
+#define fse_batch_next(event) ((fse_event_t *)((char *)(event) + FSE_EVENT_SIZE((event)->length)))
+
+fse_batch_t *fse_batch_alloc();
+/* Returns the batch to the pool. */
+void fse_batch_release(fse_batch_t *batch);
+/* Appends a record of the path, which needs not end with a NUL. */
+void fse_batch_push(fse_batch_t *batch, const char *path, size_t length, unsigned int flags, unsigned long long id);
+
+/* The handler owns the batch and releases it when done. */
+typedef void (*fse_event_handler_t)(void *context, fse_batch_t *batch);
 typedef void (*fse_thread_hook_t)(void *context);
 typedef struct fse_watcher_s* fse_watcher_t;
 
+/* Flags of fse_options_t. */
+
+/* Watch the whole filesystem of the path and filter the events by path,
+** which does not depend on the number of directories below it. Linux only,
+** with fanotify; ignored elsewhere and when fanotify is not available. */
+#define FSE_WATCH_FILESYSTEM 0x1
+
+typedef struct {
+  unsigned int flags;
+  /* Milliseconds during which the events of a path are merged, see
+  ** coalesce.h; 0 to hand on each batch as soon as it is read. */
+  unsigned int latency;
+  /* Changes of one directory beyond which it is reported as a whole, with
+  ** MustScanSubDirs; 0 for no limit. */
+  unsigned int storm;
+} fse_options_t;
+
 void fse_init();
 fse_watcher_t fse_alloc();
 void fse_free(fse_watcher_t watcherp);
-void fse_watch(const char *path, fse_event_handler_t handler, void *context, fse_thread_hook_t hookstart, fse_thread_hook_t hookend, fse_watcher_t watcher_p);
+/* Returns 0, or an errno value when the watch cannot be set up; no hook
+** runs then. */
+int fse_watch(const char *path, const fse_options_t *options, fse_event_handler_t handler, void *context, fse_thread_hook_t hookstart, fse_thread_hook_t hookend, fse_watcher_t watcher_p);
 void fse_unwatch(fse_watcher_t watcher);
 void *fse_context_of(fse_watcher_t watcher);
 #endif
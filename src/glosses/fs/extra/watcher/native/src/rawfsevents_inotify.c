@@ -0,0 +1,536 @@
+/*
+** inotify implementation of rawfsevents.h, for Linux.
+**
+** One thread per process waits on the inotify descriptors of all watchers
+** with epoll. Each watcher has its own inotify descriptor, so watch
+** descriptors are never shared between watchers and closing it drops all
+** of its watches at once. Directories are watched recursively: new and
+** moved in directories are added as they appear, moved out ones removed.
+**
+** Events are read in batches of up to FSE_READ_SIZE bytes and translated to
+** the FSEvents flags of constants.h, so that fsevents.c and the JS side
+** work the same on both platforms.
+**
+** With a latency, the events of a watch are merged for that long before
+** they are handed on, see coalesce.h; epoll_wait() times out at the end of
+** the earliest window.
+**
+** With FSE_WATCH_FILESYSTEM, a watch uses a fanotify mark on the whole
+** filesystem instead, see fanotify.h, and falls back to inotify where
+** fanotify is not available.
+*/
+
+#define _GNU_SOURCE
+
+#include "rawfsevents.h"
+#include "constants.h"
+#include "fanotify.h"
+#include "coalesce.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifndef CHECK
+#ifdef NDEBUG
+#define CHECK(x) do { if (!(x)) abort(); } while (0)
+#else
+#define CHECK assert
+#endif
+#endif
+
+#define FSE_READ_SIZE (64 * 1024)
+#define FSE_MAX_EVENTS 64
+
+#define FSE_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | \
+                  IN_DELETE_SELF | IN_MOVE_SELF | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+/* State of a watch, owned by the event thread once it is scheduled. */
+typedef struct fse_inotify_s {
+  int fd;
+  fse_fanotify_t *fan;
+  fse_options_t options;
+  fse_coalescer_t *coalescer;
+  unsigned long long due; /* end of the latency window, 0 if none is open */
+  struct fse_inotify_s *prev;
+  struct fse_inotify_s *next;
+  int stopped; /* set by fse_unwatch(), before the thread gets to it */
+  int rootwd;
+  char root[PATH_MAX];
+  char **paths; /* indexed by watch descriptor */
+  int npaths;
+  fse_event_handler_t handler;
+  fse_thread_hook_t hookstart;
+  fse_thread_hook_t hookend;
+  void *context;
+} fse_inotify_t;
+
+typedef struct fse_command_s {
+  int start;
+  fse_inotify_t *watch;
+  struct fse_command_s *next;
+} fse_command_t;
+
+typedef struct {
+  pthread_t thread;
+  int running;
+  int epfd;
+  int wakefd;
+  pthread_mutex_t lock;
+  fse_command_t *head;
+  fse_command_t *tail;
+  fse_inotify_t *watches; /* started ones, owned by the thread */
+  unsigned long long id;
+} fse_loop_t;
+
+struct fse_watcher_s {
+  fse_inotify_t *watch;
+  void *context;
+};
+
+static fse_loop_t fsevents;
+static pthread_once_t fse_once = PTHREAD_ONCE_INIT;
+
+static void fse_init_once(void) {
+  fsevents.running = 0;
+  fsevents.epfd = -1;
+  fsevents.wakefd = -1;
+  fsevents.head = NULL;
+  fsevents.tail = NULL;
+  fsevents.watches = NULL;
+  fsevents.id = 0;
+  pthread_mutex_init(&fsevents.lock, NULL);
+}
+
+void fse_init() {
+  pthread_once(&fse_once, fse_init_once);
+}
+
+/* Watch descriptor table. */
+
+static void fse_set_path(fse_inotify_t *watch, int wd, const char *path) {
+  if (wd >= watch->npaths) {
+    int n = watch->npaths ? watch->npaths : 64;
+    while (n <= wd) n *= 2;
+    watch->paths = realloc(watch->paths, sizeof(*watch->paths) * n);
+    CHECK(watch->paths);
+    memset(watch->paths + watch->npaths, 0, sizeof(*watch->paths) * (n - watch->npaths));
+    watch->npaths = n;
+  }
+  /* The same directory reached twice keeps its first path. */
+  if (!watch->paths[wd]) {
+    watch->paths[wd] = strdup(path);
+    CHECK(watch->paths[wd]);
+  }
+}
+
+static void fse_drop_path(fse_inotify_t *watch, int wd) {
+  if (wd >= 0 && wd < watch->npaths) {
+    free(watch->paths[wd]);
+    watch->paths[wd] = NULL;
+  }
+}
+
+/* Removes the watches of path and of everything below it. */
+static void fse_remove_tree(fse_inotify_t *watch, const char *path) {
+  size_t len = strlen(path);
+  int wd;
+  for (wd = 0; wd < watch->npaths; wd++) {
+    const char *p = watch->paths[wd];
+    if (p && wd != watch->rootwd && !strncmp(p, path, len) && (p[len] == 0 || p[len] == '/')) {
+      inotify_rm_watch(watch->fd, wd);
+      fse_drop_path(watch, wd);
+    }
+  }
+}
+
+static void fse_push(fse_batch_t *batch, const char *path, size_t length, unsigned int flags) {
+  fse_batch_push(batch, path, length, flags, ++fsevents.id);
+}
+
+/* Watches path and the directories below it, and returns the watch
+** descriptor of path or -1. Subdirectories that vanish or cannot be read
+** are skipped; running out of watches is reported as dropped events.
+**
+** With a batch, everything found below path is pushed to it as created:
+** entries made right after a mkdir() exist before the directory is watched
+** and would not be reported otherwise. */
+static int fse_add_tree(fse_inotify_t *watch, const char *path, fse_batch_t *batch, int *dropped) {
+  int wd = inotify_add_watch(watch->fd, path, FSE_MASK);
+  if (wd < 0) {
+    if (errno == ENOSPC) *dropped = 1;
+    return -1;
+  }
+  fse_set_path(watch, wd, path);
+
+  DIR *dir = opendir(path);
+  if (!dir) return wd;
+
+  struct dirent *entry;
+  char child[PATH_MAX];
+  while (!*dropped && (entry = readdir(dir))) {
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+    int length = snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+    if (length >= (int)sizeof(child)) continue;
+    unsigned char type = entry->d_type;
+    if (type == DT_UNKNOWN) {
+      struct stat st;
+      if (lstat(child, &st)) continue;
+      type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+    }
+    if (batch) {
+      unsigned int flags = type == DT_DIR ? kFSEventStreamEventFlagItemIsDir
+                         : type == DT_LNK ? kFSEventStreamEventFlagItemIsSymlink
+                         : kFSEventStreamEventFlagItemIsFile;
+      fse_push(batch, child, length, kFSEventStreamEventFlagItemCreated | flags);
+    }
+    if (type == DT_DIR) fse_add_tree(watch, child, batch, dropped);
+  }
+  closedir(dir);
+  return wd;
+}
+
+static void fse_free_watch(fse_inotify_t *watch) {
+  int wd;
+  if (watch->coalescer) fse_coalescer_free(watch->coalescer);
+  if (watch->fan) {
+    fse_fanotify_close(watch->fan);
+  } else if (watch->fd >= 0) {
+    close(watch->fd);
+  }
+  for (wd = 0; wd < watch->npaths; wd++) free(watch->paths[wd]);
+  free(watch->paths);
+  free(watch);
+}
+
+/* Event translation. */
+
+static unsigned int fse_flags_of(const struct inotify_event *ev, const char *path) {
+  unsigned int flags = kFSEventStreamEventFlagNone;
+  if (ev->mask & IN_CREATE) flags |= kFSEventStreamEventFlagItemCreated;
+  if (ev->mask & IN_DELETE) flags |= kFSEventStreamEventFlagItemRemoved;
+  if (ev->mask & IN_MODIFY) flags |= kFSEventStreamEventFlagItemModified;
+  if (ev->mask & IN_ATTRIB) flags |= kFSEventStreamEventFlagItemInodeMetaMod;
+  if (ev->mask & (IN_MOVED_FROM | IN_MOVED_TO)) flags |= kFSEventStreamEventFlagItemRenamed;
+
+  if (ev->mask & IN_ISDIR) {
+    flags |= kFSEventStreamEventFlagItemIsDir;
+  } else if (ev->mask & IN_CREATE) {
+    /* inotify does not tell links apart; only creations need to know. */
+    struct stat st;
+    flags |= !lstat(path, &st) && S_ISLNK(st.st_mode) ? kFSEventStreamEventFlagItemIsSymlink : kFSEventStreamEventFlagItemIsFile;
+  } else {
+    flags |= kFSEventStreamEventFlagItemIsFile;
+  }
+  return flags;
+}
+
+/* Translates one buffer of inotify events and keeps the watches in sync
+** with the directories it creates, moves and removes. */
+static void fse_translate(fse_inotify_t *watch, const char *buf, ssize_t len, fse_batch_t *batch) {
+  char path[PATH_MAX];
+  const char *p;
+  for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((const struct inotify_event *)p)->len) {
+    const struct inotify_event *ev = (const struct inotify_event *)p;
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+      fse_push(batch, watch->root, strlen(watch->root), kFSEventStreamEventFlagMustScanSubDirs | kFSEventStreamEventFlagKernelDropped);
+      continue;
+    }
+
+    const char *dir = ev->wd >= 0 && ev->wd < watch->npaths ? watch->paths[ev->wd] : NULL;
+    if (ev->mask & IN_IGNORED) {
+      fse_drop_path(watch, ev->wd);
+      continue;
+    }
+    if (!dir) continue;
+
+    if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+      /* Other directories are reported by their parent. */
+      if (ev->wd == watch->rootwd) {
+        fse_push(batch, watch->root, strlen(watch->root), kFSEventStreamEventFlagRootChanged);
+      }
+      continue;
+    }
+
+    int length = ev->len ? snprintf(path, sizeof(path), "%s/%s", dir, ev->name) : snprintf(path, sizeof(path), "%s", dir);
+    if (length >= (int)sizeof(path)) continue;
+    unsigned int flags = fse_flags_of(ev, path);
+
+    if (ev->mask & IN_ISDIR) {
+      if (ev->mask & IN_MOVED_FROM) {
+        fse_remove_tree(watch, path);
+      } else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+        /* The directory goes first, then what a new one already holds; a
+        ** moved in one is reported alone, as FSEvents does. */
+        int dropped = 0;
+        fse_push(batch, path, length, flags);
+        fse_add_tree(watch, path, ev->mask & IN_CREATE ? batch : NULL, &dropped);
+        if (dropped) {
+          fse_push(batch, path, length, kFSEventStreamEventFlagMustScanSubDirs | kFSEventStreamEventFlagUserDropped | kFSEventStreamEventFlagItemIsDir);
+        }
+        continue;
+      }
+    }
+    fse_push(batch, path, length, flags);
+  }
+}
+
+static unsigned long long fse_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void fse_deliver(fse_inotify_t *watch, fse_batch_t *batch) {
+  if (!batch) return;
+  if (batch->count && watch->handler && !__atomic_load_n(&watch->stopped, __ATOMIC_ACQUIRE)) {
+    watch->handler(watch->context, batch);
+  } else {
+    fse_batch_release(batch);
+  }
+}
+
+static void fse_flush(fse_inotify_t *watch) {
+  watch->due = 0;
+  fse_deliver(watch, fse_coalescer_take(watch->coalescer));
+}
+
+static void fse_read(fse_inotify_t *watch) {
+  char buf[FSE_READ_SIZE] __attribute__((aligned(8)));
+  for (;;) {
+    ssize_t len = read(watch->fd, buf, sizeof(buf));
+    if (len <= 0) {
+      CHECK(len == 0 || errno == EAGAIN || errno == EINTR);
+      if (len < 0 && errno == EINTR) continue;
+      return;
+    }
+
+    fse_batch_t *batch = fse_batch_alloc();
+    if (watch->fan) {
+      fse_fanotify_translate(watch->fan, buf, len, batch, &fsevents.id);
+    } else {
+      fse_translate(watch, buf, len, batch);
+    }
+    if (!watch->coalescer) {
+      fse_deliver(watch, batch);
+      continue;
+    }
+
+    fse_coalescer_add(watch->coalescer, batch);
+    fse_batch_release(batch);
+    if (!watch->due) watch->due = fse_now() + watch->options.latency;
+    if (fse_coalescer_size(watch->coalescer) >= FSE_COALESCE_MAX) fse_flush(watch);
+  }
+  /* A batch without latency is complete once the descriptor is drained. */
+  if (watch->coalescer && !watch->options.latency && watch->due) fse_flush(watch);
+}
+
+/* Flushes the windows that ended and returns the epoll_wait() timeout
+** until the next one ends. */
+static int fse_timeout() {
+  unsigned long long now = fse_now(), next = 0;
+  fse_inotify_t *watch;
+  for (watch = fsevents.watches; watch; watch = watch->next) {
+    if (watch->due && watch->due <= now) fse_flush(watch);
+    if (watch->due && (!next || watch->due < next)) next = watch->due;
+  }
+  return next ? (int)(next - now) : -1;
+}
+
+/* Event thread. */
+
+static void fse_start(fse_inotify_t *watch) {
+  if (watch->hookstart) watch->hookstart(watch->context);
+
+  /* Like FSEvents, report the real paths of the files. */
+  char real[PATH_MAX];
+  if (realpath(watch->root, real)) strcpy(watch->root, real);
+
+  if (watch->options.flags & FSE_WATCH_FILESYSTEM) {
+    watch->fan = fse_fanotify_open(watch->root);
+  }
+
+  int dropped = 0;
+  if (watch->fan) {
+    close(watch->fd);
+    watch->fd = fse_fanotify_fd(watch->fan);
+  } else {
+    watch->rootwd = fse_add_tree(watch, watch->root, NULL, &dropped);
+    if (watch->rootwd < 0) {
+      /* Same as FSEvents for a path that does not exist: no events. */
+      return;
+    }
+  }
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = watch;
+  CHECK(!epoll_ctl(fsevents.epfd, EPOLL_CTL_ADD, watch->fd, &ev));
+
+  if (watch->options.latency || watch->options.storm) {
+    watch->coalescer = fse_coalescer_alloc(watch->options.storm);
+  }
+  watch->next = fsevents.watches;
+  if (watch->next) watch->next->prev = watch;
+  fsevents.watches = watch;
+
+  if (dropped) {
+    fse_batch_t *batch = fse_batch_alloc();
+    fse_push(batch, watch->root, strlen(watch->root), kFSEventStreamEventFlagMustScanSubDirs | kFSEventStreamEventFlagUserDropped);
+    fse_deliver(watch, batch);
+  }
+}
+
+static void fse_stop(fse_inotify_t *watch) {
+  if (watch->fd >= 0) epoll_ctl(fsevents.epfd, EPOLL_CTL_DEL, watch->fd, NULL);
+  if (watch->prev) {
+    watch->prev->next = watch->next;
+  } else if (fsevents.watches == watch) {
+    fsevents.watches = watch->next;
+  }
+  if (watch->next) watch->next->prev = watch->prev;
+  fse_thread_hook_t hookend = watch->hookend;
+  void *context = watch->context;
+  fse_free_watch(watch);
+  if (hookend) hookend(context);
+}
+
+static void fse_run_commands() {
+  uint64_t n;
+  while (read(fsevents.wakefd, &n, sizeof(n)) < 0 && errno == EINTR);
+
+  pthread_mutex_lock(&fsevents.lock);
+  fse_command_t *command = fsevents.head;
+  fsevents.head = fsevents.tail = NULL;
+  pthread_mutex_unlock(&fsevents.lock);
+
+  while (command) {
+    fse_command_t *next = command->next;
+    if (command->start) {
+      fse_start(command->watch);
+    } else {
+      fse_stop(command->watch);
+    }
+    free(command);
+    command = next;
+  }
+}
+
+static void *fse_run_loop(void *) {
+  struct epoll_event events[FSE_MAX_EVENTS];
+  for (;;) {
+    int n = epoll_wait(fsevents.epfd, events, FSE_MAX_EVENTS, fse_timeout());
+    if (n < 0) {
+      CHECK(errno == EINTR);
+      continue;
+    }
+
+    /* Commands go last, so that no watch is freed while the events of
+    ** this round still point to it. */
+    int idx, wakeup = 0;
+    for (idx = 0; idx < n; idx++) {
+      if (events[idx].data.ptr) {
+        fse_read(events[idx].data.ptr);
+      } else {
+        wakeup = 1;
+      }
+    }
+    if (wakeup) fse_run_commands();
+  }
+  return NULL;
+}
+
+static void fse_post(int start, fse_inotify_t *watch) {
+  fse_command_t *command = malloc(sizeof(*command));
+  CHECK(command);
+  command->start = start;
+  command->watch = watch;
+  command->next = NULL;
+
+  pthread_mutex_lock(&fsevents.lock);
+  if (!fsevents.running) {
+    struct epoll_event ev;
+    fsevents.epfd = epoll_create1(EPOLL_CLOEXEC);
+    fsevents.wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK(fsevents.epfd >= 0 && fsevents.wakefd >= 0);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    CHECK(!epoll_ctl(fsevents.epfd, EPOLL_CTL_ADD, fsevents.wakefd, &ev));
+    CHECK(!pthread_create(&fsevents.thread, NULL, fse_run_loop, NULL));
+    pthread_detach(fsevents.thread);
+    fsevents.running = 1;
+  }
+  if (fsevents.tail) {
+    fsevents.tail->next = command;
+  } else {
+    fsevents.head = command;
+  }
+  fsevents.tail = command;
+  pthread_mutex_unlock(&fsevents.lock);
+
+  uint64_t one = 1;
+  while (write(fsevents.wakefd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+/* rawfsevents.h */
+
+fse_watcher_t fse_alloc() {
+  fse_watcher_t watcher = malloc(sizeof(*watcher));
+  CHECK(watcher);
+  watcher->watch = NULL;
+  watcher->context = NULL;
+  return watcher;
+}
+
+void fse_free(fse_watcher_t watcher) {
+  fse_unwatch(watcher);
+  free(watcher);
+}
+
+int fse_watch(const char *path, const fse_options_t *options, fse_event_handler_t handler, void *context, fse_thread_hook_t hookstart, fse_thread_hook_t hookend, fse_watcher_t watcher) {
+  /* Opened here rather than on the event thread, so that running out of
+  ** instances (fs.inotify.max_user_instances) reaches the caller. It also
+  ** backs the fallback of a fanotify watch. */
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) return errno;
+
+  fse_inotify_t *watch = calloc(1, sizeof(*watch));
+  CHECK(watch);
+  watch->fd = fd;
+  watch->rootwd = -1;
+  strncpy(watch->root, path, sizeof(watch->root) - 1);
+  watch->options = *options;
+  watch->handler = handler;
+  watch->hookstart = hookstart;
+  watch->hookend = hookend;
+  watch->context = context;
+
+  watcher->watch = watch;
+  watcher->context = context;
+  fse_post(1, watch);
+  return 0;
+}
+
+void fse_unwatch(fse_watcher_t watcher) {
+  fse_inotify_t *watch = watcher->watch;
+  watcher->watch = NULL;
+  watcher->context = NULL;
+  if (watch) {
+    __atomic_store_n(&watch->stopped, 1, __ATOMIC_RELEASE);
+    fse_post(0, watch);
+  }
+}
+
+void *fse_context_of(fse_watcher_t watcher) {
+  return watcher->context;
+}
@@ -0,0 +1,260 @@
+#ifndef __ADONE_EXECUTOR_H_
+#define __ADONE_EXECUTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Bounded thread pool for the CPU heavy work of addons, so that it does not
+// compete with fs, dns and zlib for the four threads of the libuv pool.
+//
+// Jobs wait in one of three lanes and idle threads always take the oldest
+// job of the most urgent lane that has one. Each lane holds at most
+// queueDepth jobs; Submit() refuses jobs beyond that instead of blocking,
+// and the drain listeners are told once every lane is back to half of it.
+// Threads are started with the first job and stay for the whole process.
+
+namespace adone
+{
+
+enum Lane
+{
+  kLaneHigh = 0,
+  kLaneNormal = 1,
+  kLaneLow = 2,
+  kLaneCount = 3
+};
+
+class ExecutorJob
+{
+public:
+  ExecutorJob() : owner(NULL) {}
+  virtual ~ExecutorJob() {}
+
+  // Called on a pool thread.
+  virtual void Perform() = 0;
+
+  // Tag of whoever submitted the job, for Executor::Cancel().
+  const void *owner;
+};
+
+class ExecutorListener
+{
+public:
+  virtual ~ExecutorListener() {}
+
+  // Called on a pool thread, with no lock held.
+  virtual void OnDrain() = 0;
+};
+
+struct ExecutorStats
+{
+  size_t threads;
+  size_t queueDepth;
+  size_t queued[kLaneCount];
+  size_t running;
+  uint64_t completed;
+  uint64_t rejected;
+};
+
+class Executor
+{
+public:
+  static const size_t kDefaultQueueDepth = 1024;
+
+  Executor(size_t threads, size_t queueDepth)
+      : threads(std::max<size_t>(threads, 1)), queueDepth(std::max<size_t>(queueDepth, 1)),
+        live(0), running(0), completed(0), rejected(0), wantDrain(false) {}
+
+  // Instance of the addon, with as many threads as cores, but at most four.
+  // It is never destroyed: its threads may still wait for jobs when the
+  // process exits.
+  static Executor &Default()
+  {
+    static Executor *executor = new Executor(DefaultThreads(), kDefaultQueueDepth);
+    return *executor;
+  }
+
+  static size_t DefaultThreads()
+  {
+    unsigned int n = std::thread::hardware_concurrency();
+    return std::min<size_t>(std::max<unsigned int>(n, 1), 4);
+  }
+
+  // Returns false, without taking the job, if its lane is full.
+  bool Submit(ExecutorJob *job, Lane lane)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (lanes[lane].size() >= queueDepth)
+    {
+      rejected++;
+      wantDrain = true;
+      return false;
+    }
+
+    lanes[lane].push_back(job);
+    Spawn();
+    lock.unlock();
+
+    ready.notify_one();
+    return true;
+  }
+
+  // Removes the jobs of the owner that have not started yet and returns
+  // them; the caller is responsible for them again.
+  std::vector<ExecutorJob *> Cancel(const void *owner)
+  {
+    std::vector<ExecutorJob *> res;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = 0; i < kLaneCount; i++)
+    {
+      std::deque<ExecutorJob *> &lane = lanes[i];
+      for (std::deque<ExecutorJob *>::iterator it = lane.begin(); it != lane.end();)
+      {
+        if ((*it)->owner == owner)
+        {
+          res.push_back(*it);
+          it = lane.erase(it);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+    }
+    return res;
+  }
+
+  // Threads beyond a lower count exit once they are done with their job.
+  void Configure(size_t threads, size_t queueDepth)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    this->threads = std::max<size_t>(threads, 1);
+    this->queueDepth = std::max<size_t>(queueDepth, 1);
+    if (Queued() > 0)
+      Spawn();
+    lock.unlock();
+
+    ready.notify_all();
+  }
+
+  ExecutorStats Stats()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ExecutorStats res;
+    res.threads = threads;
+    res.queueDepth = queueDepth;
+    for (int i = 0; i < kLaneCount; i++)
+      res.queued[i] = lanes[i].size();
+    res.running = running;
+    res.completed = completed;
+    res.rejected = rejected;
+    return res;
+  }
+
+  void AddListener(ExecutorListener *listener)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    listeners.push_back(listener);
+  }
+
+  void RemoveListener(ExecutorListener *listener)
+  {
+    std::lock_guard<std::mutex> lock(listenersMutex);
+    std::lock_guard<std::mutex> lock2(mutex);
+    listeners.erase(std::remove(listeners.begin(), listeners.end(), listener), listeners.end());
+  }
+
+private:
+  Executor(const Executor &);
+  void operator=(const Executor &);
+
+  size_t Queued() const
+  {
+    return lanes[kLaneHigh].size() + lanes[kLaneNormal].size() + lanes[kLaneLow].size();
+  }
+
+  // Starts threads up to the configured count, with the lock held.
+  void Spawn()
+  {
+    for (; live < threads && live < Queued() + running; live++)
+      std::thread(&Executor::Work, this).detach();
+  }
+
+  void Work()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+      if (live > threads)
+        break;
+
+      int i = 0;
+      while (i < kLaneCount && lanes[i].empty())
+        i++;
+      if (i == kLaneCount)
+      {
+        ready.wait(lock);
+        continue;
+      }
+
+      ExecutorJob *job = lanes[i].front();
+      lanes[i].pop_front();
+      running++;
+
+      bool drained = wantDrain;
+      for (int j = 0; drained && j < kLaneCount; j++)
+        drained = lanes[j].size() <= queueDepth / 2;
+      if (drained)
+        wantDrain = false;
+      lock.unlock();
+
+      if (drained)
+        NotifyDrain();
+      job->Perform();
+
+      lock.lock();
+      running--;
+      completed++;
+    }
+    live--;
+  }
+
+  // Listeners are only removed under listenersMutex, so they stay valid
+  // while they are called without the main lock.
+  void NotifyDrain()
+  {
+    std::lock_guard<std::mutex> lock(listenersMutex);
+    std::vector<ExecutorListener *> targets;
+    {
+      std::lock_guard<std::mutex> lock2(mutex);
+      targets = listeners;
+    }
+    for (size_t i = 0; i < targets.size(); i++)
+      targets[i]->OnDrain();
+  }
+
+  std::mutex mutex;
+  std::mutex listenersMutex;
+  std::condition_variable ready;
+  std::deque<ExecutorJob *> lanes[kLaneCount];
+  std::vector<ExecutorListener *> listeners;
+
+  size_t threads;
+  size_t queueDepth;
+  size_t live;
+  size_t running;
+  uint64_t completed;
+  uint64_t rejected;
+  bool wantDrain;
+};
+
+} // namespace adone
+
+#endif // __ADONE_EXECUTOR_H_
@@ -0,0 +1,342 @@
+#ifndef __ADONE_EXECUTOR_NAPI_H_
+#define __ADONE_EXECUTOR_NAPI_H_
+
+// N-API side of executor.h: workers in the style of Napi::AsyncWorker that
+// run on the pool of the addon and complete on the JS thread that queued
+// them. Requires NAPI_VERSION 4 or later, for thread-safe functions.
+//
+// Addons call Dispatcher::Setup() in their init function, for each JS
+// thread (main or worker) that loads them, and may export the controls of
+// the pool with ExportExecutor().
+
+#include <napi.h>
+
+#include <chrono>
+#include <string>
+
+#include "executor.h"
+
+namespace adone
+{
+namespace napi
+{
+
+class Worker;
+
+// Delivers the completions of the workers of one JS thread, and the drain
+// notifications of the pool, through a thread-safe function. It keeps the
+// event loop alive only while workers are pending or JS waits for a drain.
+class Dispatcher : public ExecutorListener
+{
+public:
+  static void Setup(Napi::Env env, Executor &executor = Executor::Default())
+  {
+    Dispatcher *dispatcher = new Dispatcher(env, executor);
+    Napi::Function noop = Napi::Function::New(env, Noop);
+    napi_status status = napi_create_threadsafe_function(
+        env, noop, NULL, Napi::String::New(env, "adone.executor"), 0, 1, dispatcher, Finalize, dispatcher, CallJs,
+        &dispatcher->tsfn);
+    if (status != napi_ok)
+    {
+      delete dispatcher;
+      NAPI_THROW_VOID(Napi::Error::New(env));
+    }
+
+    napi_unref_threadsafe_function(env, dispatcher->tsfn);
+    napi_add_env_cleanup_hook(env, Cleanup, dispatcher);
+    executor.AddListener(dispatcher);
+    Current() = dispatcher;
+  }
+
+  // Dispatcher of the calling JS thread.
+  static Dispatcher *&Current()
+  {
+    static thread_local Dispatcher *dispatcher = NULL;
+    return dispatcher;
+  }
+
+  Executor &GetExecutor() { return executor; }
+
+  // Called when the pool has room again after refusing a job.
+  void SetDrainCallback(Napi::Function callback)
+  {
+    drain = Napi::Persistent(callback);
+  }
+
+  bool Submit(Worker *worker, Lane lane);
+
+  void OnDrain()
+  {
+    napi_call_threadsafe_function(tsfn, NULL, napi_tsfn_nonblocking);
+  }
+
+private:
+  Dispatcher(Napi::Env env, Executor &executor)
+      : env(env), executor(executor), tsfn(NULL), pending(0), saturated(false), referenced(false), posting(0) {}
+
+  static Napi::Value Noop(const Napi::CallbackInfo &info)
+  {
+    return info.Env().Undefined();
+  }
+
+  // Called on a pool thread when the worker is done.
+  void Post(Worker *worker)
+  {
+    napi_call_threadsafe_function(tsfn, worker, napi_tsfn_nonblocking);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    posting--;
+    posted.notify_all();
+  }
+
+  void UpdateRef()
+  {
+    bool wanted = pending > 0 || saturated;
+    if (wanted == referenced)
+      return;
+
+    referenced = wanted;
+    if (wanted)
+      napi_ref_threadsafe_function(env, tsfn);
+    else
+      napi_unref_threadsafe_function(env, tsfn);
+  }
+
+  static void CallJs(napi_env env, napi_value, void *context, void *data);
+
+  // Runs when the JS thread goes away: workers that did not start are
+  // dropped and the running ones are waited for, so that nothing is posted
+  // once the thread-safe function is released.
+  static void Cleanup(void *arg)
+  {
+    Dispatcher *dispatcher = static_cast<Dispatcher *>(arg);
+    dispatcher->executor.RemoveListener(dispatcher);
+
+    std::vector<ExecutorJob *> cancelled = dispatcher->executor.Cancel(dispatcher);
+    for (size_t i = 0; i < cancelled.size(); i++)
+      delete cancelled[i];
+
+    {
+      std::unique_lock<std::mutex> lock(dispatcher->mutex);
+      dispatcher->posting -= cancelled.size();
+      while (dispatcher->posting > 0)
+        dispatcher->posted.wait(lock);
+    }
+
+    if (Current() == dispatcher)
+      Current() = NULL;
+    napi_release_threadsafe_function(dispatcher->tsfn, napi_tsfn_abort);
+  }
+
+  static void Finalize(napi_env, void *data, void *)
+  {
+    delete static_cast<Dispatcher *>(data);
+  }
+
+  friend class Worker;
+
+  napi_env env;
+  Executor &executor;
+  napi_threadsafe_function tsfn;
+  Napi::FunctionReference drain;
+
+  // Owned by the JS thread.
+  size_t pending;
+  bool saturated;
+  bool referenced;
+
+  // Workers submitted but not posted back yet.
+  std::mutex mutex;
+  std::condition_variable posted;
+  size_t posting;
+};
+
+// Base class of pooled workers. Like with Napi::AsyncWorker, Execute() runs
+// on a pool thread and must not touch JS, then OnOK() or OnError() run on
+// the JS thread, after which the worker is deleted.
+class Worker : public ExecutorJob
+{
+public:
+  virtual ~Worker() {}
+
+  Napi::Env Env() const { return Napi::Env(env); }
+
+  // Returns false if the lane is full or the addon did not set up a
+  // dispatcher; the worker then still belongs to the caller.
+  bool Queue(Lane lane = kLaneNormal)
+  {
+    Dispatcher *dispatcher = Dispatcher::Current();
+    queuedAt = Now();
+    return dispatcher != NULL && dispatcher->Submit(this, lane);
+  }
+
+protected:
+  explicit Worker(Napi::Env env) : env(env), failed(false), queuedAt(0) {}
+
+  virtual void Execute() = 0;
+  virtual void OnOK() = 0;
+  virtual void OnError(const Napi::Error &e) = 0;
+
+  // Called on the pool thread after Execute(), with whether it failed and
+  // the nanoseconds the worker waited in the queue and spent in Execute(),
+  // e.g. for telemetry.
+  virtual void OnExecuted(bool, uint64_t, uint64_t) {}
+
+  void SetError(const std::string &message)
+  {
+    failed = true;
+    error = message;
+  }
+
+private:
+  friend class Dispatcher;
+
+  static uint64_t Now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void Perform()
+  {
+    uint64_t start = Now();
+    Execute();
+    OnExecuted(failed, start - queuedAt, Now() - start);
+    static_cast<Dispatcher *>(const_cast<void *>(owner))->Post(this);
+  }
+
+  void Complete()
+  {
+    if (failed)
+      OnError(Napi::Error::New(Env(), error));
+    else
+      OnOK();
+  }
+
+  napi_env env;
+  bool failed;
+  std::string error;
+  uint64_t queuedAt;
+};
+
+inline bool Dispatcher::Submit(Worker *worker, Lane lane)
+{
+  worker->owner = this;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    posting++;
+  }
+
+  bool res = executor.Submit(worker, lane);
+  if (res)
+  {
+    pending++;
+  }
+  else
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    posting--;
+    saturated = true;
+  }
+
+  UpdateRef();
+  return res;
+}
+
+inline void Dispatcher::CallJs(napi_env env, napi_value, void *context, void *data)
+{
+  Dispatcher *dispatcher = static_cast<Dispatcher *>(context);
+
+  // Drain notification.
+  if (data == NULL)
+  {
+    if (env == NULL || !dispatcher->saturated)
+      return;
+
+    dispatcher->saturated = false;
+    dispatcher->UpdateRef();
+    if (!dispatcher->drain.IsEmpty())
+      dispatcher->drain.Call({});
+    return;
+  }
+
+  Worker *worker = static_cast<Worker *>(data);
+  if (env != NULL)
+  {
+    dispatcher->pending--;
+    dispatcher->UpdateRef();
+    worker->Complete();
+  }
+  delete worker;
+}
+
+namespace detail
+{
+
+inline size_t SizeOption(Napi::Object options, const char *name, size_t fallback)
+{
+  Napi::Value value = options.Get(name);
+  return value.IsNumber() ? static_cast<size_t>(value.As<Napi::Number>().Int64Value()) : fallback;
+}
+
+// configure({ threads, queueDepth }): missing options keep their value.
+inline Napi::Value Configure(const Napi::CallbackInfo &info)
+{
+  Executor &executor = Dispatcher::Current()->GetExecutor();
+  ExecutorStats stats = executor.Stats();
+  if (info[0].IsObject())
+  {
+    Napi::Object options = info[0].As<Napi::Object>();
+    executor.Configure(SizeOption(options, "threads", stats.threads), SizeOption(options, "queueDepth", stats.queueDepth));
+  }
+  return info.Env().Undefined();
+}
+
+inline Napi::Value Stats(const Napi::CallbackInfo &info)
+{
+  Napi::Env env = info.Env();
+  ExecutorStats stats = Dispatcher::Current()->GetExecutor().Stats();
+
+  Napi::Object queued = Napi::Object::New(env);
+  queued.Set("high", Napi::Number::New(env, static_cast<double>(stats.queued[kLaneHigh])));
+  queued.Set("normal", Napi::Number::New(env, static_cast<double>(stats.queued[kLaneNormal])));
+  queued.Set("low", Napi::Number::New(env, static_cast<double>(stats.queued[kLaneLow])));
+
+  Napi::Object res = Napi::Object::New(env);
+  res.Set("threads", Napi::Number::New(env, static_cast<double>(stats.threads)));
+  res.Set("queueDepth", Napi::Number::New(env, static_cast<double>(stats.queueDepth)));
+  res.Set("queued", queued);
+  res.Set("running", Napi::Number::New(env, static_cast<double>(stats.running)));
+  res.Set("completed", Napi::Number::New(env, static_cast<double>(stats.completed)));
+  res.Set("rejected", Napi::Number::New(env, static_cast<double>(stats.rejected)));
+  return res;
+}
+
+inline Napi::Value OnDrain(const Napi::CallbackInfo &info)
+{
+  if (!info[0].IsFunction())
+  {
+    Napi::TypeError::New(info.Env(), "Callback must be a function").ThrowAsJavaScriptException();
+    return info.Env().Undefined();
+  }
+
+  Dispatcher::Current()->SetDrainCallback(info[0].As<Napi::Function>());
+  return info.Env().Undefined();
+}
+
+} // namespace detail
+
+// Exports `executor` with configure(options), stats() and onDrain(callback).
+inline void ExportExecutor(Napi::Env env, Napi::Object exports)
+{
+  Napi::Object executor = Napi::Object::New(env);
+  executor.Set("configure", Napi::Function::New(env, detail::Configure));
+  executor.Set("stats", Napi::Function::New(env, detail::Stats));
+  executor.Set("onDrain", Napi::Function::New(env, detail::OnDrain));
+  exports.Set("executor", executor);
+}
+
+} // namespace napi
+} // namespace adone
+
+#endif // __ADONE_EXECUTOR_NAPI_H_
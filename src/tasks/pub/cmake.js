@@ -1,5 +1,6 @@
 const {
     fast,
+    fs,
     nodejs,
     path,
     realm: { BaseTask }
@@ -7,9 +8,31 @@ const {
 
 @adone.task.task("cmake")
 export default class extends BaseTask {
-    async main({ src, dst, files } = {}) {
+    async main({ src, dst, files, prebuilds = false } = {}) {
         const version = process.version;
         const realm = this.manager;
+        const realmRootPath = realm.getPath();
+
+        let srcGlob;
+        if (files) {
+            srcGlob = files;
+        } else {
+            srcGlob = "*.node";
+        }
+
+        // N-API addons are ABI-stable, so a binary prebuilt for the platform
+        // works with every node version and there is nothing to compile.
+        if (prebuilds) {
+            const prebuildPath = path.join(realmRootPath, src, "prebuilds", `${process.platform}-${process.arch}`);
+            if (await fs.exists(prebuildPath)) {
+                await fast.src(srcGlob, {
+                    cwd: prebuildPath
+                }).dest(path.join(realmRootPath, dst), {
+                    produceFiles: true
+                });
+                return;
+            }
+        }
 
         const nodeManager = new nodejs.NodejsManager({ realm });
         const nodePath = await nodeManager.prepareDevFiles({
@@ -27,16 +50,8 @@ export default class extends BaseTask {
             path: src
         });
 
-        const realmRootPath = realm.getPath();
         const buildPath = nodejs.cmake.getBuildPath(realm, src);
 
-        let srcGlob;
-        if (files) {
-            srcGlob = files;
-        } else {
-            srcGlob = "*.node";
-        }
-
         await fast.src(srcGlob, {
             cwd: path.join(buildPath, "Release")
         }).dest(path.join(realmRootPath, dst), {
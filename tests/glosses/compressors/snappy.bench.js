@@ -0,0 +1,131 @@
+/**
+ * Benchmark of the snappy binding as seen from JS: input conversion, dispatch to the thread pool,
+ * promise resolution and creation of the result Buffers, on top of the codec itself.
+ *
+ * Reports MB/s of uncompressed data and heap allocations per call for the sync, async and batch
+ * paths with payloads from 64 B to 64 MB. Run it through the build of the addon:
+ *
+ *     cmake -DSNAPPY_BUILD_BENCHMARKS=ON ... && cmake --build . --target snappy_bench
+ *
+ * or by hand: node snappy.bench.js <snappy.node> [<snappy_alloc_counter.node>] [--quick]
+ * Allocations are only counted with the counter preloaded (LD_PRELOAD), otherwise shown as "-".
+ */
+const { performance } = require("perf_hooks");
+
+const args = process.argv.slice(2).filter((arg) => !arg.startsWith("--"));
+const quick = process.argv.includes("--quick");
+
+if (args.length < 1) {
+    console.error("usage: node snappy.bench.js <snappy.node> [<snappy_alloc_counter.node>] [--quick]");
+    process.exit(1);
+}
+
+const native = require(args[0]);
+
+// Counts allocations only when this library is the preloaded malloc of the process.
+const allocations = (() => {
+    if (args.length < 2) {
+        return null;
+    }
+    const counter = require(args[1]);
+    const before = counter.count();
+    Buffer.alloc(1 << 16);
+    return counter.count() > before ? counter.count : null;
+})();
+
+const SIZES = [64, 1 << 10, 16 << 10, 256 << 10, 4 << 20, 64 << 20];
+const BATCH = 16;
+const MIN_TIME = quick ? 50 : 500;
+const MIN_CALLS = 3;
+
+// Text with some variety, compressing to about half of its size like typical payloads.
+const makeInput = (length) => {
+    const parts = [];
+    let size = 0;
+    for (let i = 0; size < length; ++i) {
+        const part = `beep boop ${(i * 2654435761) % 1000003} hello world. OMG ${i % 97} `;
+        parts.push(part);
+        size += part.length;
+    }
+    return Buffer.from(parts.join("")).slice(0, length);
+};
+
+const report = (path, size, calls, bytes, elapsed, allocs) => {
+    const mbs = bytes / (elapsed / 1000) / (1 << 20);
+    const perCall = allocations ? (allocs / calls).toFixed(2) : "-";
+    console.log(`${path.padEnd(28)} ${String(size).padStart(9)} B ${mbs.toFixed(1).padStart(10)} MB/s ${perCall.padStart(10)} allocs/call`);
+};
+
+// Runs fn until MIN_TIME has passed, after a warm up call. bytes is the uncompressed size per call.
+const measureSync = (path, size, bytes, fn) => {
+    fn();
+    const before = allocations ? allocations() : 0;
+    const start = performance.now();
+    let calls = 0;
+    let elapsed;
+    do {
+        fn();
+        ++calls;
+        elapsed = performance.now() - start;
+    } while (elapsed < MIN_TIME || calls < MIN_CALLS);
+    report(path, size, calls, bytes * calls, elapsed, allocations ? allocations() - before : 0);
+};
+
+// Same for functions returning promises, awaiting each call before the next one, so the time
+// includes a full round trip to the thread pool.
+const measureAsync = async (path, size, bytes, fn) => {
+    await fn();
+    const before = allocations ? allocations() : 0;
+    const start = performance.now();
+    let calls = 0;
+    let elapsed;
+    do {
+        await fn(); // eslint-disable-line no-await-in-loop
+        ++calls;
+        elapsed = performance.now() - start;
+    } while (elapsed < MIN_TIME || calls < MIN_CALLS);
+    report(path, size, calls, bytes * calls, elapsed, allocations ? allocations() - before : 0);
+};
+
+const bench = async (size) => {
+    const input = makeInput(size);
+    const string = input.toString("latin1");
+    const compressed = native.compressSync(input);
+    const asBuffer = { asBuffer: true };
+    const asString = { asBuffer: false };
+
+    measureSync("compressSync", size, size, () => native.compressSync(input));
+    measureSync("compressSync (string)", size, size, () => native.compressSync(string));
+    measureSync("uncompressSync", size, size, () => native.uncompressSync(compressed, asBuffer));
+    measureSync("uncompressSync (string)", size, size, () => native.uncompressSync(compressed, asString));
+    measureSync("isValidCompressedSync", size, size, () => native.isValidCompressedSync(compressed));
+
+    const output = Buffer.alloc(compressed.length);
+    measureSync("compressIntoSync", size, size, () => native.compressIntoSync(input, output, 0));
+
+    await measureAsync("compress", size, size, () => native.compress(input));
+    await measureAsync("uncompress", size, size, () => native.uncompress(compressed, asBuffer));
+
+    // Batches are only worth it for small messages; keep the large ones to a single copy of memory.
+    if (size <= (256 << 10)) {
+        const inputs = new Array(BATCH).fill(input);
+        const compressedInputs = new Array(BATCH).fill(compressed);
+        measureSync(`compressBatchSync (${BATCH})`, size, size * BATCH, () => native.compressBatchSync(inputs));
+        measureSync(`uncompressBatchSync (${BATCH})`, size, size * BATCH, () => native.uncompressBatchSync(compressedInputs));
+        await measureAsync(`compressBatch (${BATCH})`, size, size * BATCH, () => native.compressBatch(inputs));
+        await measureAsync(`uncompressBatch (${BATCH})`, size, size * BATCH, () => native.uncompressBatch(compressedInputs));
+    }
+};
+
+const main = async () => {
+    console.log(`snappy binding, ${native.kernels} kernels, node ${process.version}`);
+    for (const size of SIZES) {
+        await bench(size); // eslint-disable-line no-await-in-loop
+        console.log();
+    }
+};
+
+main().catch((err) => {
+    console.error(err);
+    process.exit(1);
+});
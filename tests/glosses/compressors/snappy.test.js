@@ -1,8 +1,55 @@
 const { is } = adone;
-const { compress, decompress, compressSync, isValidCompressedSync, decompressSync, isValidCompressed } = adone.compressor.snappy;
+const {
+    compress,
+    decompress,
+    compressSync,
+    isValidCompressedSync,
+    decompressSync,
+    isValidCompressed,
+    compressInto,
+    compressIntoSync,
+    decompressInto,
+    decompressIntoSync,
+    decompressToBuffers,
+    decompressToBuffersSync,
+    getUncompressedLength,
+    compressStream,
+    decompressStream,
+    compressFramed,
+    decompressFramed,
+    compressBatch,
+    compressBatchSync,
+    decompressBatch,
+    decompressBatchSync,
+    Context,
+    Decoder,
+    executor,
+    kernels,
+    levels,
+    stats
+} = adone.compressor.snappy;
 const inputString = "beep boop, hello world. OMG OMG OMG";
 const inputBuffer = Buffer.from(inputString);
 
+const pipeThrough = (stream, chunks) => new Promise((resolve, reject) => {
+    const out = [];
+    stream.on("data", (data) => out.push(data));
+    stream.on("end", () => resolve(Buffer.concat(out)));
+    stream.on("error", reject);
+    for (const chunk of chunks) {
+        stream.write(chunk);
+    }
+    stream.end();
+});
+
+const split = (buffer, size) => {
+    const chunks = [];
+    for (let i = 0; i < buffer.length; i += size) {
+        chunks.push(buffer.slice(i, i + size));
+    }
+    return chunks;
+};
+
 describe("compressor", "snappy", () => {
     it("compress() string", async () => {
         const buffer = await compress(inputString);
@@ -14,6 +61,12 @@ describe("compressor", "snappy", () => {
         assert.isTrue(is.buffer(buffer));
     });
 
+    it("compress() string with multibyte characters", async () => {
+        const str = "привет, \u0000 мир ✓";
+        const buffer = await compress(str);
+        assert.equal(decompressSync(buffer, { asBuffer: false }), str);
+    });
+
     it("compress() bad input", () => {
         assert.throws(() => compress(123), "Input must be a String or a Buffer");
     });
@@ -28,6 +81,42 @@ describe("compressor", "snappy", () => {
         assert.isTrue(is.buffer(buffer));
     });
 
+    it("compressSync() string with multibyte characters after ASCII", () => {
+        const str = `${"a".repeat(99)}é${"b".repeat(10)}`;
+        const buffer = compressSync(str);
+        assert.deepEqual(decompressSync(buffer), Buffer.from(str));
+        assert.equal(decompressSync(buffer, { asBuffer: false }), str);
+    });
+
+    it("compressSync() levels roundtrip", () => {
+        const words = ["snappy", "level", "compress", "the", "of", "fast", "best"];
+        const input = Buffer.from(new Array(50000).fill(0).map((_, i) => words[(i * 7 + (i >> 3)) % words.length] + i % 97).join(" "));
+        const sizes = [levels.FAST, levels.DEFAULT, levels.BEST].map((level) => {
+            const compressed = compressSync(input, { level });
+            assert.isTrue(isValidCompressedSync(compressed));
+            assert.deepEqual(decompressSync(compressed), input);
+            return compressed.length;
+        });
+        assert.deepEqual(compressSync(input, { level: levels.DEFAULT }), compressSync(input));
+        assert.isAtMost(sizes[2], sizes[1]);
+        assert.isAtMost(sizes[1], sizes[0]);
+    });
+
+    it("compress() with every level and stream", async () => {
+        const input = Buffer.concat(new Array(5000).fill(inputBuffer));
+        for (const level of [levels.FAST, levels.BEST]) {
+            assert.deepEqual(await decompress(await compress(input, { level })), input);
+            assert.deepEqual(await decompressFramed(await compressFramed(input, { level })), input);
+            const framed = await pipeThrough(compressStream({ level }), split(input, 100000));
+            assert.deepEqual(await pipeThrough(decompressStream(), [framed]), input);
+        }
+    });
+
+    it("compressSync() bad level", () => {
+        assert.throws(() => compressSync(inputBuffer, { level: 4 }), "Level must be");
+        assert.throws(() => compressBatchSync([inputBuffer], { level: "best" }), "Level must be");
+    });
+
     it("isValidCompressed() on valid data", async () => {
         const compressed = await compress(inputBuffer);
         const isCompressed = await isValidCompressed(compressed);
@@ -50,6 +139,18 @@ describe("compressor", "snappy", () => {
         assert.isFalse(isCompressed);
     });
 
+    it("kernels names the decompression kernels in use", () => {
+        assert.include(["avx2", "generic"], kernels);
+    });
+
+    it("decompressSync() of short repeated patterns", () => {
+        const input = Buffer.alloc(100000);
+        for (let i = 0; i < input.length; ++i) {
+            input[i] = i % (1 + (i >> 6) % 7);
+        }
+        assert.deepEqual(decompressSync(compressSync(input)), input);
+    });
+
     it("decompress() defaults to Buffer", async () => {
         const compressed = await compress(inputBuffer);
         const buffer = await decompress(compressed);
@@ -116,4 +217,331 @@ describe("compressor", "snappy", () => {
     it("decompressSync() on bad input", () => {
         assert.throws(() => decompressSync(Buffer.from("beep boop OMG OMG OMG")), "Invalid input");
     });
+
+    it("getUncompressedLength()", () => {
+        assert.equal(getUncompressedLength(compressSync(inputBuffer)), inputBuffer.length);
+        assert.throws(() => getUncompressedLength(Buffer.from([0xff, 0xff, 0xff, 0xff, 0xff, 0xff])), "Invalid input");
+    });
+
+    it("decompressSync() with maxOutput", () => {
+        const compressed = compressSync(inputBuffer);
+        assert.deepEqual(decompressSync(compressed, { maxOutput: inputBuffer.length }), inputBuffer);
+        assert.throws(() => decompressSync(compressed, { maxOutput: inputBuffer.length - 1 }), RangeError);
+        assert.throws(() => new Decoder({ maxOutput: 1 }).push(compressed), RangeError);
+    });
+
+    it("decompress() with maxOutput", async () => {
+        const promise = decompress(compressSync(inputBuffer), { maxOutput: 10 });
+        assert.isTrue(is.promise(promise));
+        await assert.throws(async () => promise, RangeError);
+    });
+
+    it("compressIntoSync() writes at offset", () => {
+        const expected = compressSync(inputBuffer);
+        const output = Buffer.alloc(expected.length + 10);
+        const written = compressIntoSync(inputBuffer, output, 10);
+        assert.equal(written, expected.length);
+        assert.deepEqual(output.slice(10, 10 + written), expected);
+    });
+
+    it("compressIntoSync() into exactly sized ArrayBuffer", () => {
+        const expected = compressSync(inputBuffer);
+        const output = new ArrayBuffer(expected.length);
+        assert.equal(compressIntoSync(inputString, output), expected.length);
+        assert.deepEqual(Buffer.from(output), expected);
+    });
+
+    it("compressIntoSync() into too small buffer", () => {
+        const expected = compressSync(inputBuffer);
+        assert.throws(() => compressIntoSync(inputBuffer, Buffer.alloc(expected.length - 1)), RangeError);
+    });
+
+    it("compressInto() into too small buffer", async () => {
+        await assert.throws(async () => compressInto(inputBuffer, Buffer.alloc(4)), RangeError);
+    });
+
+    it("compressInto() rejects offset out of bounds", async () => {
+        const promise = compressInto(inputBuffer, Buffer.alloc(4), 5);
+        assert.isTrue(is.promise(promise));
+        await assert.throws(async () => promise, RangeError);
+    });
+
+    it("decompressInto() roundtrip", async () => {
+        const compressed = compressSync(inputBuffer);
+        const output = Buffer.alloc(inputBuffer.length + 3);
+        const written = await decompressInto(compressed, output, 3);
+        assert.equal(written, inputBuffer.length);
+        assert.deepEqual(output.slice(3), inputBuffer);
+    });
+
+    it("decompressIntoSync() into too small buffer", () => {
+        const compressed = compressSync(inputBuffer);
+        assert.throws(() => decompressIntoSync(compressed, Buffer.alloc(inputBuffer.length), 1), RangeError);
+    });
+
+    it("decompressIntoSync() with offset out of bounds", () => {
+        const compressed = compressSync(inputBuffer);
+        assert.throws(() => decompressIntoSync(compressed, Buffer.alloc(4), 5), RangeError);
+    });
+
+    it("decompressToBuffersSync() fills buffers in order", () => {
+        const input = Buffer.alloc(10000, inputString);
+        const outputs = [Buffer.alloc(4096), Buffer.alloc(4096), Buffer.alloc(4096)];
+        assert.equal(decompressToBuffersSync(compressSync(input), outputs), input.length);
+        assert.deepEqual(Buffer.concat(outputs).slice(0, input.length), input);
+    });
+
+    it("decompressToBuffers() into a BufferList", async () => {
+        const input = Buffer.alloc(100000, inputString);
+        const bl = new adone.collections.BufferList.BufferList();
+        for (let i = 0; i < 25; ++i) {
+            bl.append(Buffer.alloc(4096));
+        }
+        assert.equal(await decompressToBuffers(compressSync(input), bl), input.length);
+        assert.deepEqual(bl.slice(0, input.length), input);
+    });
+
+    it("decompressToBuffersSync() into too small buffers", () => {
+        const compressed = compressSync(inputBuffer);
+        assert.throws(() => decompressToBuffersSync(compressed, [Buffer.alloc(4), Buffer.alloc(4)]), RangeError);
+    });
+
+    it("Decoder decodes a block pushed in pieces", () => {
+        const input = Buffer.alloc(100000, inputString);
+        const decoder = new Decoder();
+        const parts = split(compressSync(input), 333).map((chunk) => Buffer.from(decoder.push(chunk)));
+        assert.isAbove(parts[1].length, 0);
+        assert.deepEqual(Buffer.concat(parts), input);
+        assert.deepEqual(decoder.end(), input);
+    });
+
+    it("Decoder on truncated input", () => {
+        const decoder = new Decoder();
+        decoder.push(compressSync(inputBuffer).slice(0, -1));
+        assert.throws(() => decoder.end(), "Unexpected end of input");
+    });
+
+    it("Decoder on trailing data", () => {
+        const decoder = new Decoder();
+        assert.throws(() => decoder.push(Buffer.concat([compressSync(inputBuffer), inputBuffer])), "Invalid input");
+    });
+
+    it("sync calls in a loop keep memory bounded", () => {
+        const input = Buffer.alloc(1024 * 1024, inputString);
+        const compressed = compressSync(input);
+        const rss = process.memoryUsage().rss;
+        for (let i = 0; i < 200; i++) {
+            compressSync(input);
+            compressSync(inputString);
+            decompressSync(compressed);
+            const decoder = new Decoder();
+            decoder.push(compressed);
+            decoder.end();
+        }
+        // without a turn of the event loop, finalizers never run
+        assert.isBelow(process.memoryUsage().rss - rss, 128 * 1024 * 1024);
+    });
+
+    it("Decoder keeps failing after an error", () => {
+        const compressed = compressSync(Buffer.alloc(100, inputString));
+        const decoder = new Decoder({ maxOutput: 10 });
+        assert.throws(() => decoder.push(compressed.slice(0, 1)), RangeError);
+        assert.throws(() => decoder.push(compressed.slice(1)), RangeError);
+        assert.throws(() => decoder.end(), RangeError);
+
+        const invalid = new Decoder();
+        assert.throws(() => invalid.push(Buffer.concat([compressSync(inputBuffer), inputBuffer])), "Invalid input");
+        assert.throws(() => invalid.push(inputBuffer), "Invalid input");
+        assert.throws(() => invalid.end(), "Invalid input");
+    });
+
+    it("compressStream() starts with the stream identifier", async () => {
+        const framed = await pipeThrough(compressStream(), []);
+        assert.deepEqual(framed, Buffer.from("ff060000734e61507059", "hex"));
+    });
+
+    it("compressStream() and decompressStream() roundtrip", async () => {
+        const input = Buffer.concat(new Array(20000).fill(inputBuffer));
+        const framed = await pipeThrough(compressStream(), split(input, 100000));
+        assert.isBelow(framed.length, input.length);
+        const output = await pipeThrough(decompressStream(), split(framed, 777));
+        assert.deepEqual(output, input);
+    });
+
+    it("decompressStream() on bad checksum", async () => {
+        const framed = await pipeThrough(compressStream(), [inputBuffer]);
+        framed[framed.length - 1] ^= 0xff;
+        await assert.throws(async () => pipeThrough(decompressStream(), [framed]));
+    });
+
+    it("decompressStream() on truncated stream", async () => {
+        const framed = await pipeThrough(compressStream(), [inputBuffer]);
+        await assert.throws(async () => pipeThrough(decompressStream(), [framed.slice(0, -1)]), "Unexpected end of stream");
+    });
+
+    it("decompressStream() and decompressFramed() check chunks without data", async () => {
+        const identifier = Buffer.from("ff060000734e61507059", "hex");
+        const empty = Buffer.from("01040000d8ea82a2", "hex");
+        const corrupt = Buffer.from("0104000000000000", "hex");
+        assert.lengthOf(await decompressFramed(Buffer.concat([identifier, empty])), 0);
+        assert.lengthOf(await pipeThrough(decompressStream(), [identifier, empty]), 0);
+        await assert.throws(async () => decompressFramed(Buffer.concat([identifier, corrupt])), "Checksum mismatch");
+        await assert.throws(async () => pipeThrough(decompressStream(), [identifier, corrupt]), "Checksum mismatch");
+    });
+
+    it("compressStream() and decompressStream() run on the pool", async () => {
+        const before = stats();
+        const framed = await pipeThrough(compressStream(), [inputBuffer]);
+        await pipeThrough(decompressStream(), [framed]);
+        const after = stats();
+        assert.isAbove(after.compressStream.asyncCalls, before.compressStream.asyncCalls);
+        assert.isAbove(after.uncompressStream.asyncCalls, before.uncompressStream.asyncCalls);
+    });
+
+    it("compressFramed() and decompressFramed() roundtrip", async () => {
+        const input = Buffer.concat(new Array(100000).fill(inputBuffer));
+        const framed = await compressFramed(input, { threads: 4 });
+        assert.deepEqual(await decompressFramed(framed, { threads: 3 }), input);
+        assert.deepEqual(await pipeThrough(decompressStream(), split(framed, 4096)), input);
+    });
+
+    it("compressFramed() and decompressFramed() share the threads of the pool", async () => {
+        const { threads } = executor.stats();
+        executor.configure({ threads: 2 });
+        try {
+            const input = Buffer.concat(new Array(50000).fill(inputBuffer));
+            const framed = await Promise.all(new Array(8).fill(input).map((i) => compressFramed(i, { threads: 8 })));
+            const outputs = await Promise.all(framed.map((f) => decompressFramed(f, { threads: 8 })));
+            for (const output of outputs) {
+                assert.deepEqual(output, input);
+            }
+            assert.equal(executor.stats().threads, 2);
+        } finally {
+            executor.configure({ threads });
+        }
+    });
+
+    it("decompressFramed() reads output of compressStream()", async () => {
+        const framed = await pipeThrough(compressStream(), [inputBuffer, inputBuffer]);
+        assert.deepEqual(await decompressFramed(framed), Buffer.concat([inputBuffer, inputBuffer]));
+    });
+
+    it("decompressFramed() on truncated stream", async () => {
+        const framed = await compressFramed(inputBuffer);
+        await assert.throws(async () => decompressFramed(framed.slice(0, -1)), "Unexpected end of stream");
+    });
+
+    it("compressBatch() and decompressBatch() roundtrip", async () => {
+        const inputs = [inputBuffer, Buffer.alloc(0), inputString.repeat(10)];
+        const compressed = await compressBatch(inputs);
+        assert.lengthOf(compressed, 3);
+        assert.deepEqual(compressed[0], compressSync(inputBuffer));
+        const output = await decompressBatch(compressed);
+        assert.deepEqual(output.map((b) => b.toString()), [inputString, "", inputString.repeat(10)]);
+    });
+
+    it("compressBatchSync() packed", () => {
+        const { data, offsets } = compressBatchSync([inputBuffer, inputBuffer], { packed: true });
+        assert.lengthOf(offsets, 3);
+        assert.equal(offsets[2], data.length);
+        assert.deepEqual(data.slice(offsets[1], offsets[2]), compressSync(inputBuffer));
+    });
+
+    it("decompressBatchSync() on bad input", () => {
+        assert.throws(() => decompressBatchSync([compressSync(inputBuffer), Buffer.from("beep boop OMG OMG OMG")]), "Invalid input");
+    });
+
+    it("decompressBatch() on not a Buffer", () => {
+        assert.throws(() => decompressBatch([inputString]), "Input must be a Buffer");
+    });
+
+    it("Context compresses the same as compressSync()", () => {
+        const context = new Context();
+        const input = Buffer.alloc(100000, inputString);
+        const expected = compressSync(input);
+        assert.deepEqual(context.compressSync(input), expected);
+        assert.deepEqual(context.compressSync(inputString), compressSync(inputString));
+
+        const output = Buffer.alloc(expected.length);
+        assert.equal(context.compressIntoSync(input, output), expected.length);
+        assert.deepEqual(output, expected);
+        assert.throws(() => context.compressIntoSync(input, Buffer.alloc(expected.length - 1)), RangeError);
+    });
+
+    it("executor queues calls beyond its queue depth", async () => {
+        const { threads, queueDepth } = executor.stats();
+        executor.configure({ queueDepth: 2 });
+        try {
+            const input = Buffer.alloc(1 << 20, inputString);
+            const pending = [];
+            for (let i = 0; i < 20; i++) {
+                pending.push(compress(input));
+            }
+            const expected = compressSync(input);
+            for (const output of await Promise.all(pending)) {
+                assert.deepEqual(output, expected);
+            }
+            assert.equal(executor.stats().waiting, 0);
+        } finally {
+            executor.configure({ threads, queueDepth });
+        }
+    });
+
+    it("executor rejects calls beyond maxWaiting", async () => {
+        const { threads, queueDepth, maxWaiting } = executor.stats();
+        executor.configure({ threads: 1, queueDepth: 1, maxWaiting: 2 });
+        try {
+            const input = Buffer.alloc(1 << 20, inputString);
+            const results = await Promise.all(new Array(20).fill(input).map((i) => compress(i).then(() => null, (err) => err)));
+            const saturated = results.filter((err) => err !== null);
+            assert.isAbove(saturated.length, 0);
+            for (const err of saturated) {
+                assert.instanceOf(err, adone.error.LimitExceededException);
+            }
+            assert.isAtLeast(results.length - saturated.length, 3);
+            assert.equal(executor.stats().waiting, 0);
+        } finally {
+            executor.configure({ threads, queueDepth, maxWaiting });
+        }
+    });
+
+    it("executor.configure() on bad options", () => {
+        assert.throws(() => executor.configure({ threads: 0 }), "threads must be a positive integer");
+        assert.throws(() => executor.configure({ queueDepth: 1.5 }), "queueDepth must be a positive integer");
+        assert.throws(() => executor.configure({ maxWaiting: -1 }), "maxWaiting must be a non-negative integer");
+    });
+
+    it("stats() counts calls, bytes and failures", async () => {
+        stats({ reset: true });
+        const compressed = compressSync(inputBuffer);
+        await compress(inputBuffer);
+        decompressSync(compressed);
+        assert.throws(() => decompressSync(Buffer.from("beep boop OMG OMG OMG")), "Invalid input");
+
+        const counters = stats({ reset: true });
+        assert.equal(counters.compress.calls, 2);
+        assert.equal(counters.compress.asyncCalls, 1);
+        assert.equal(counters.compress.bytesIn, 2 * inputBuffer.length);
+        assert.equal(counters.compress.bytesOut, 2 * compressed.length);
+        assert.equal(counters.uncompress.calls, 2);
+        assert.equal(counters.uncompress.failures, 1);
+        assert.equal(counters.uncompress.bytesOut, inputBuffer.length);
+        assert.isAbove(counters.compress.executeNs, 0);
+
+        assert.equal(stats().compress.calls, 0);
+    });
+
+    it("compress() with adaptive stores incompressible data", async () => {
+        const random = adone.std.crypto.randomBytes(256 * 1024);
+        const text = Buffer.alloc(256 * 1024, inputString);
+        const input = Buffer.concat([text, random]);
+
+        stats({ reset: true });
+        const compressed = await compress(input, { adaptive: true });
+        assert.equal(stats().compress.storedBytes, random.length);
+        assert.isTrue(isValidCompressedSync(compressed));
+        assert.deepEqual(decompressSync(compressed), input);
+        assert.deepEqual(compressSync(text, { adaptive: true }), compressSync(text));
+        assert.isAtMost(compressSync(random, { adaptive: true }).length, random.length + 32);
+    });
 });
@@ -0,0 +1,61 @@
+describe("crypto", "crc", () => {
+    const {
+        crypto: { crc }
+    } = adone;
+
+    // Long enough for the native kernels
+    const pattern = Buffer.alloc(1000);
+    for (let i = 0; i < pattern.length; i++) {
+        pattern[i] = (i * 31 + 7) & 0xff;
+    }
+
+    describe("crc32", () => {
+        it("check values", () => {
+            expect(crc.crc32.unsigned("123456789")).to.be.equal(0xcbf43926);
+            expect(crc.crc32.unsigned(pattern)).to.be.equal(0x8902161e);
+            expect(crc.crc32.signed(pattern)).to.be.equal(0x8902161e | 0);
+        });
+
+        it("continues from a previous crc", () => {
+            for (const split of [1, 63, 64, 500, 999]) {
+                const head = crc.crc32.unsigned(pattern.slice(0, split));
+                expect(crc.crc32.unsigned(pattern.slice(split), head)).to.be.equal(0x8902161e);
+            }
+        });
+
+        it("previous of 0 means the same for short and long buffers", () => {
+            const short = pattern.slice(0, 10);
+            const long = pattern.slice(0, 100);
+            const bytewise = (buf) => {
+                let value = 0;
+                for (let i = 0; i < buf.length; i++) {
+                    value = crc.crc32.signed(buf.slice(i, i + 1), i === 0 ? 0 : value);
+                }
+                return value;
+            };
+            expect(crc.crc32.signed(short, 0)).to.be.equal(bytewise(short));
+            expect(crc.crc32.signed(long, 0)).to.be.equal(bytewise(long));
+        });
+    });
+
+    describe("crc32c", () => {
+        it("check values", () => {
+            expect(crc.crc32c.unsigned("123456789")).to.be.equal(0xe3069283);
+            expect(crc.crc32c.unsigned(Buffer.alloc(32))).to.be.equal(0x8a9136aa);
+            expect(crc.crc32c.unsigned(Buffer.alloc(32, 0xff))).to.be.equal(0x62a8ab43);
+            expect(crc.crc32c.unsigned(pattern)).to.be.equal(0xff52ee97);
+        });
+
+        it("continues from a previous crc", () => {
+            for (const split of [1, 7, 300, 999]) {
+                const head = crc.crc32c.unsigned(pattern.slice(0, split));
+                expect(crc.crc32c.unsigned(pattern.slice(split), head)).to.be.equal(0xff52ee97);
+            }
+        });
+
+        it("reports the kernels in use", () => {
+            expect(crc.crc32c.kernels.crc32).to.be.oneOf(["generic", "pclmul", "table"]);
+            expect(crc.crc32c.kernels.crc32c).to.be.oneOf(["generic", "sse4.2", "table"]);
+        });
+    });
+});
@@ -2303,9 +2303,125 @@ describe("watcher", function watcherTests() {
         });
     };
 
-    if (os === "darwin") {
+    if (os === "darwin" || os === "linux") {
         describe("fsevents (native extension)", runTests.bind(this, { useFsEvents: true }));
     }
+    if (os === "linux") {
+        describe("fsevents (fanotify)", runTests.bind(this, { useFsEvents: true, useFanotify: true }));
+    }
+    if (os === "darwin" || os === "linux") {
+        describe("fsevents batches", () => {
+            const fsevents = require(adone.getPath("lib", "glosses", "fs", "extra", "watcher", "fsevents"));
+
+            it("should deliver the events of a wakeup as one batch", async () => {
+                const batches = [];
+                const stop = fsevents.watchBatch(fixtures.path(), (batch) => batches.push(batch), { latency: 200 });
+                await sleep(300);
+
+                await Promise.all(Array.from({ length: 20 }, (_, i) => fixtures.addFile(`file${i}.txt`, { contents: "a" })));
+                await sleep(600);
+                await stop();
+
+                const paths = [];
+                for (const batch of batches) {
+                    expect(batch).to.be.instanceOf(fsevents.EventBatch);
+                    for (const event of batch) {
+                        expect(event.flags & fsevents.constants.kFSEventStreamEventFlagItemIsFile).to.be.ok();
+                        paths.push(adone.path.basename(event.path));
+                    }
+                }
+                expect(batches.length).to.be.below(5);
+                for (let i = 0; i < 20; i++) {
+                    expect(paths).to.include(`file${i}.txt`);
+                }
+            });
+
+            it("should report files written right after their directory is created", async () => {
+                const paths = new Set();
+                const stop = fsevents.watch(fixtures.path(), (path) => {
+                    paths.add(adone.path.join(adone.path.basename(adone.path.dirname(path)), adone.path.basename(path)));
+                }, { latency: 0 });
+                await sleep(300);
+
+                for (let i = 0; i < 100; i++) {
+                    const dir = adone.path.join(fixtures.path(), `dir${i}`);
+                    adone.std.fs.mkdirSync(dir);
+                    adone.std.fs.writeFileSync(adone.path.join(dir, "file.txt"), "a");
+                }
+                await sleep(600);
+                await stop();
+
+                for (let i = 0; i < 100; i++) {
+                    expect(paths.has(adone.path.join(`dir${i}`, "file.txt"))).to.be.true();
+                }
+            });
+        });
+
+        describe("fsevents coalescing", () => {
+            it("should report a storm of changes in one directory as one rescan", async () => {
+                const storm = await fixtures.addDirectory("storm");
+                const addSpy = spy();
+                const rawSpy = spy();
+                watcher = watch(fixtures.path(), {
+                    useFsEvents: true,
+                    ignoreInitial: true,
+                    coalesce: { latency: 500, storm: 10 }
+                }).on("add", addSpy).on("raw", rawSpy);
+                await new Promise((resolve) => watcher.on("ready", resolve));
+                await sleep(300);
+
+                await Promise.all(Array.from({ length: 50 }, (_, i) => storm.addFile(`file${i}.txt`, { contents: "a" })));
+                await sleep(1500);
+
+                expect(addSpy).to.have.callCount(50);
+                expect(rawSpy.callCount).to.be.below(10);
+            });
+
+            it("should report the files removed by a storm", async () => {
+                const storm = await fixtures.addDirectory("storm");
+                const files = await Promise.all(Array.from({ length: 50 }, (_, i) => storm.addFile(`file${i}.txt`, { contents: "a" })));
+                const unlinkSpy = spy();
+                const rawSpy = spy();
+                watcher = watch(fixtures.path(), {
+                    useFsEvents: true,
+                    ignoreInitial: true,
+                    coalesce: { latency: 500, storm: 10 }
+                }).on("unlink", unlinkSpy).on("raw", rawSpy);
+                await new Promise((resolve) => watcher.on("ready", resolve));
+                await sleep(300);
+
+                await Promise.all(files.map((file) => file.unlink()));
+                await sleep(1500);
+
+                expect(unlinkSpy).to.have.callCount(50);
+                for (const file of files) {
+                    expect(unlinkSpy).to.have.been.calledWith(file.path());
+                }
+                expect(rawSpy.callCount).to.be.below(10);
+            });
+
+            it("should report the files modified by a storm", async () => {
+                const storm = await fixtures.addDirectory("storm");
+                const files = await Promise.all(Array.from({ length: 50 }, (_, i) => storm.addFile(`file${i}.txt`, { contents: "a" })));
+                const changeSpy = spy();
+                watcher = watch(fixtures.path(), {
+                    useFsEvents: true,
+                    ignoreInitial: true,
+                    coalesce: { latency: 500, storm: 10 }
+                }).on("change", changeSpy);
+                await new Promise((resolve) => watcher.on("ready", resolve));
+                await sleep(300);
+
+                await Promise.all(files.map((file) => file.write("b")));
+                await sleep(1500);
+
+                expect(changeSpy).to.have.callCount(50);
+                for (const file of files) {
+                    expect(changeSpy).to.have.been.calledWith(file.path());
+                }
+            });
+        });
+    }
     if (os !== "darwin") {
         describe("fs.watch (non-polling)", runTests.bind(this, { usePolling: false, useFsEvents: false }));
     }